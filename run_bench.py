@@ -0,0 +1,34 @@
+import json
+import re
+import statistics
+import sys
+from typing import List, Tuple
+
+from run_test import ENGINES, build, execute
+
+BENCHMARKS = ["test/prime.clo", "test/qsort.clo", "test/rebind.clo"]
+REPEAT = 5
+
+def measure(engine: str, filepath: str) -> Tuple[int, float]:
+    with open(filepath[:-3] + "json", "r") as f:
+        io = json.loads(f.read())
+    code, _, err = execute(["bin/clocalc", f"--engine={engine}", "--stats", filepath], io["in"])
+    m = re.search(r"\[stats\] (\d+) steps in (\S+) seconds", err)
+    if code or not m:
+        sys.exit(f"{filepath} ({engine}) failed\n{err}")
+    return (int(m.group(1)), float(m.group(2)))
+
+def bench(filepaths: List[str]) -> None:
+    for filepath in filepaths:
+        for engine in ENGINES:
+            results = [measure(engine, filepath) for _ in range(REPEAT)]
+            steps = results[0][0]
+            seconds = statistics.median(r[1] for r in results)
+            print(
+                f"{filepath} ({engine}): {steps} steps, "
+                f"median {seconds:.3f} seconds, {steps / seconds / 1e6:.2f}M steps per second"
+            )
+
+if __name__ == "__main__":
+    build("release")
+    bench(sys.argv[1:] if len(sys.argv) > 1 else BENCHMARKS)
@@ -7,6 +7,11 @@ import sys
 import time
 from typing import List, Tuple, Union
 
+ENGINES = ["ast", "bytecode"]
+# stop-the-world (the default), incremental and parallel collections,
+# and execution resumed on a copy of the state every 100000 steps
+OPTIONS = [[], ["--gc-budget=4"], ["--gc-threads=4"], ["--copy-every=100000"]]
+
 def execute(cmd: List[str], i: Union[None, str] = None) -> Tuple[int, str, str]:
     result = subprocess.run(
         cmd,
@@ -26,18 +31,20 @@ def build(build_type: str) -> None:
     end = time.time()
     print(f"OK ({end - start:.3f} seconds)")
 
-def test() -> None:
+def test(engine: str, options: List[str]) -> None:
     for dirpath, _, filenames in os.walk("test/"):
         for filename in filenames:
             if filename.endswith(".clo"):
                 filepath = os.path.join(dirpath, filename)
-                print(f"running test {filepath} ... ", end = "")
+                print(f"running test {filepath} ({' '.join([engine] + options)}) ... ", end = "")
                 sys.stdout.flush()
                 iopath = filepath[:-3] + "json"
                 with open(iopath, "r") as f:
                     io = json.loads(f.read())
                 start = time.time()
-                res = execute(["bin/clocalc", filepath], io["in"])
+                res = execute(
+                    ["bin/clocalc", f"--engine={engine}", *options, filepath], io["in"]
+                )
                 end = time.time()
                 if (
                     (res[0] == 0) == (io["err"] == "") and
@@ -51,8 +58,12 @@ def test() -> None:
 if __name__ == "__main__":
     print("# started testing debug version")
     build("debug")
-    test()
+    for engine in ENGINES:
+        for options in OPTIONS:
+            test(engine, options)
     print("# started testing release version")
     build("release")
-    test()
+    for engine in ENGINES:
+        for options in OPTIONS:
+            test(engine, options)
     print("passed all tests")
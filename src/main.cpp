@@ -1,42 +1,43 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cctype>
+#include <chrono>
 #include <concepts>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
-#include <deque>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <span>
 #include <stdexcept>
+#include <thread>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
-#include <variant>
 #include <vector>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
 // ------------------------------
 // global helper(s)
 // ------------------------------
 
-template <typename Type, typename Variant>
-struct isAlternativeOfHelper {
-    static constexpr bool value = false;
-};
-
-template <typename Type, typename... Alternative>
-requires ((0 + ... + (std::same_as<Type, Alternative> ? 1 : 0)) == 1)
-struct isAlternativeOfHelper<Type, std::variant<Alternative...>> {
-    static constexpr bool value = true;
-};
-
-template <typename Type, typename Variant>
-constexpr bool isAlternativeOf = isAlternativeOfHelper<Type, Variant>::value;
-
 struct SourceLocation {
     SourceLocation(int l = 1, int c = 1): line(l), column(c) {}
 
@@ -46,18 +47,6 @@ struct SourceLocation {
         }
         return "(SourceLocation " + std::to_string(line) + " " + std::to_string(column) + ")";
     }
-    void revert() {
-        line = 1;
-        column = 1;
-    }
-    void update(char c) {
-        if (c == '\n') {
-            line++;
-            column = 1;
-        } else {
-            column++;
-        }
-    }
 
     int line;
     int column;
@@ -129,1713 +118,3968 @@ std::string unquote(std::string s) {
     return r;
 }
 
-struct SourceStream {
-    SourceStream(std::string s): source(std::move(s)) {
-        std::string charstr =
-            "`1234567890-=~!@#$%^&*()_+"
-            "qwertyuiopasdfghjklzxcvbnmQWERTYUIOPASDFGHJKLZXCVBNM"
-            "[]\\;',./{}|:\"<>? \t\n";
-        std::unordered_set<char> charset(charstr.begin(), charstr.end());
-        for (char c : source) {
-            if (!charset.contains(c)) {
-                panic("lexer", "unsupported character", sl);
-            }
-            sl.update(c);
+// the supported alphabet: printable ASCII characters, tabs, and newlines
+constexpr bool isSourceChar(char c) {
+    return (c >= ' ' && c <= '~') || c == '\t' || c == '\n';
+}
+
+constexpr bool isSpaceChar(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+constexpr bool isDigitChar(char c) {
+    return c >= '0' && c <= '9';
+}
+
+constexpr bool isAlphaChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// ------------------------------
+// character scanning kernels
+// ------------------------------
+
+// each kernel scans [p, p + n) and returns the offset of the first byte it stops at (or n);
+// the SIMD versions classify a whole block per iteration and leave the tail to the scalar version
+
+std::size_t scalarFindInvalid(const char *p, std::size_t n) {
+    std::size_t i = 0;
+    while (i < n && isSourceChar(p[i])) {
+        i++;
+    }
+    return i;
+}
+
+std::size_t scalarSkipSpaces(const char *p, std::size_t n) {
+    std::size_t i = 0;
+    while (i < n && isSpaceChar(p[i])) {
+        i++;
+    }
+    return i;
+}
+
+std::size_t scalarFindEither(const char *p, std::size_t n, char a, char b) {
+    std::size_t i = 0;
+    while (i < n && p[i] != a && p[i] != b) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CLOCALC_X86_SIMD
+
+// SSE2 is part of the x86-64 baseline
+
+std::size_t sse2FindInvalid(const char *p, std::size_t n) {
+    // signed comparisons: bytes >= 0x80 are negative and thus fail (c > 0x1f)
+    const __m128i lo = _mm_set1_epi8(0x1f), hi = _mm_set1_epi8(0x7f);
+    const __m128i tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n');
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i ok = _mm_or_si128(
+            _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, nl))
+        );
+        unsigned bad = ~static_cast<unsigned>(_mm_movemask_epi8(ok)) & 0xffffu;
+        if (bad) {
+            return i + std::countr_zero(bad);
         }
-        sl.revert();
-        std::reverse(source.begin(), source.end());
     }
+    return i + scalarFindInvalid(p + i, n - i);
+}
 
-    bool hasNext() const {
-        return source.size() > 0;
+std::size_t sse2SkipSpaces(const char *p, std::size_t n) {
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n');
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i space = _mm_or_si128(
+            _mm_cmpeq_epi8(v, sp),
+            _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, nl))
+        );
+        unsigned other = ~static_cast<unsigned>(_mm_movemask_epi8(space)) & 0xffffu;
+        if (other) {
+            return i + std::countr_zero(other);
+        }
     }
-    char peekNext() const {
-        return source.back();
+    return i + scalarSkipSpaces(p + i, n - i);
+}
+
+std::size_t sse2FindEither(const char *p, std::size_t n, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        unsigned hit = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)))
+        );
+        if (hit) {
+            return i + std::countr_zero(hit);
+        }
     }
-    char popNext() {
-        char c = source.back();
-        source.pop_back();
-        sl.update(c);
-        return c;
+    return i + scalarFindEither(p + i, n - i, a, b);
+}
+
+__attribute__((target("avx2")))
+std::size_t avx2FindInvalid(const char *p, std::size_t n) {
+    const __m256i lo = _mm256_set1_epi8(0x1f), hi = _mm256_set1_epi8(0x7f);
+    const __m256i tab = _mm256_set1_epi8('\t'), nl = _mm256_set1_epi8('\n');
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i ok = _mm256_or_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, nl))
+        );
+        std::uint32_t bad = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(ok));
+        if (bad) {
+            return i + std::countr_zero(bad);
+        }
     }
-    SourceLocation getNextSourceLocation() const {
-        return sl;
+    return i + sse2FindInvalid(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+std::size_t avx2SkipSpaces(const char *p, std::size_t n) {
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), nl = _mm256_set1_epi8('\n');
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i space = _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, sp),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, nl))
+        );
+        std::uint32_t other = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(space));
+        if (other) {
+            return i + std::countr_zero(other);
+        }
     }
+    return i + sse2SkipSpaces(p + i, n - i);
+}
 
-    std::string source;
+__attribute__((target("avx2")))
+std::size_t avx2FindEither(const char *p, std::size_t n, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        std::uint32_t hit = static_cast<std::uint32_t>(
+            _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)))
+        );
+        if (hit) {
+            return i + std::countr_zero(hit);
+        }
+    }
+    return i + sse2FindEither(p + i, n - i, a, b);
+}
+
+#endif
+
+struct ScanKernels {
+    std::string_view name;
+    std::size_t (*findInvalid)(const char*, std::size_t);
+    std::size_t (*skipSpaces)(const char*, std::size_t);
+    std::size_t (*findEither)(const char*, std::size_t, char, char);
+};
+
+// selected once, on first use, according to the running CPU
+const ScanKernels &scanKernels() {
+    static const ScanKernels kernels = []() -> ScanKernels {
+#ifdef CLOCALC_X86_SIMD
+        if (__builtin_cpu_supports("avx2")) {
+            return {"avx2", avx2FindInvalid, avx2SkipSpaces, avx2FindEither};
+        }
+        return {"sse2", sse2FindInvalid, sse2SkipSpaces, sse2FindEither};
+#else
+        return {"scalar", scalarFindInvalid, scalarSkipSpaces, scalarFindEither};
+#endif
+    }();
+    return kernels;
+}
+
+// the following return absolute offsets into source (source.size() if not found)
+
+std::size_t findInvalidSourceChar(std::string_view source, std::size_t pos = 0) {
+    return pos + scanKernels().findInvalid(source.data() + pos, source.size() - pos);
+}
+
+std::size_t skipSpaces(std::string_view source, std::size_t pos) {
+    return pos + scanKernels().skipSpaces(source.data() + pos, source.size() - pos);
+}
+
+std::size_t findNewline(std::string_view source, std::size_t pos) {
+    return pos + scanKernels().findEither(source.data() + pos, source.size() - pos, '\n', '\n');
+}
+
+// the closing quote of a string literal whose body starts at pos
+std::size_t findClosingQuote(std::string_view source, std::size_t pos) {
+    while (true) {
+        pos += scanKernels().findEither(source.data() + pos, source.size() - pos, '"', '\\');
+        if (pos >= source.size() || source[pos] == '"') {
+            return pos;
+        }
+        // skip the escaped character (if any)
+        pos += 2;
+        if (pos >= source.size()) {
+            return source.size();
+        }
+    }
+}
+
+// computes line and column numbers on demand,
+// scanning forward from the previous query (so in-order queries cost O(n) in total)
+class SourceLocator {
+public:
+    SourceLocator(std::string_view s): source(s) {}
+
+    SourceLocation locate(std::size_t offset) {
+        if (offset < cursor) {
+            cursor = 0;
+            sl = SourceLocation();
+        }
+        while (cursor < offset) {
+            auto newline = findNewline(source, cursor);
+            if (newline >= offset) {
+                sl.column += offset - cursor;
+                cursor = offset;
+            } else {
+                sl.line++;
+                sl.column = 1;
+                cursor = newline + 1;
+            }
+        }
+        return sl;
+    }
+private:
+    std::string_view source;
+    std::size_t cursor = 0;
     SourceLocation sl;
 };
 
+// interned identifier
+using Symbol = std::uint32_t;
+
+// per-program identifier table; names are only needed for error messages and printing
+class SymbolTable {
+public:
+    Symbol intern(std::string_view name) {
+        auto iter = ids.find(name);
+        if (iter != ids.end()) {
+            return iter->second;
+        }
+        Symbol symbol = names.size();
+        names.emplace_back(name);
+        ids.emplace(names.back(), symbol);
+        return symbol;
+    }
+    const std::string &name(Symbol symbol) const {
+        return names[symbol];
+    }
+    std::size_t size() const {
+        return names.size();
+    }
+private:
+    // heterogeneous lookup: interning an existing name doesn't construct a string
+    struct NameHash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const {
+            return std::hash<std::string_view>()(s);
+        }
+    };
+    std::unordered_map<std::string, Symbol, NameHash, std::equal_to<>> ids;
+    std::vector<std::string> names;
+};
+
+enum class TokenKind {
+    integer,
+    string,
+    identifier,  // variable or keyword
+    intrinsic,
+    leftParen,
+    rightParen,
+    leftBrace,
+    rightBrace,
+    at
+};
+
+// a view into the source buffer
 struct Token {
-    Token(SourceLocation s, std::string t) : sl(s), text(std::move(t)) {}
+    std::string_view text(std::string_view source) const {
+        return source.substr(offset, length);
+    }
 
-    SourceLocation sl;
-    std::string text;
+    TokenKind kind;
+    std::uint32_t offset;
+    std::uint32_t length;
+    // only meaningful for identifiers
+    Symbol symbol;
 };
 
-std::deque<Token> lex(std::string source) {
-    SourceStream ss(std::move(source));
+// produces tokens on demand
+class Lexer {
+public:
+    // the whole source is validated upfront so that unsupported characters are always reported first
+    Lexer(std::string_view s, SymbolTable &y): source(s), symbols(y) {
+        if (source.size() > UINT32_MAX) {
+            panic("lexer", "source too large");
+        }
+        if (auto invalid = findInvalidSourceChar(source); invalid < source.size()) {
+            panic("lexer", "unsupported character", SourceLocator(source).locate(invalid));
+        }
+    }
 
-    std::function<std::optional<Token>()> nextToken =
-        [&ss, &nextToken]() -> std::optional<Token> {
-        // skip whitespaces
-        while (ss.hasNext() && std::isspace(ss.peekNext())) {
-            ss.popNext();
+    std::optional<Token> next() {
+        std::size_t n = source.size();
+        // skip whitespaces and comments
+        pos = skipSpaces(source, pos);
+        while (pos < n && source[pos] == '#') {
+            pos = skipSpaces(source, findNewline(source, pos));
         }
-        if (!ss.hasNext()) {
+        if (pos == n) {
             return std::nullopt;
         }
         // read the next token
-        auto startsl = ss.getNextSourceLocation();
-        std::string text = "";
+        std::size_t start = pos;
+        char c = source[pos];
+        TokenKind kind;
+        Symbol symbol = 0;
         // integer literal
-        if (std::isdigit(ss.peekNext()) || ss.peekNext() == '-' || ss.peekNext() == '+') {
-            if (ss.peekNext() == '-' || ss.peekNext() == '+') {
-                text += ss.popNext();
+        if (isDigitChar(c) || c == '-' || c == '+') {
+            kind = TokenKind::integer;
+            if (c == '-' || c == '+') {
+                pos++;
             }
-            bool hasDigit = false;
-            while (ss.hasNext() && std::isdigit(ss.peekNext())) {
-                hasDigit = true;
-                text += ss.popNext();
+            std::size_t digitStart = pos;
+            while (pos < n && isDigitChar(source[pos])) {
+                pos++;
             }
-            if (!hasDigit) {
-                panic("lexer", "incomplete integer literal", startsl);
+            if (pos == digitStart) {
+                panic("lexer", "incomplete integer literal", SourceLocator(source).locate(start));
             }
         // string literal
-        } else if (ss.peekNext() == '"') {
-            text += ss.popNext();
-            bool complete = false;
-            bool escape = false;
-            while (ss.hasNext()) {
-                if ((!escape) && ss.peekNext() == '"') {
-                    text += ss.popNext();
-                    complete = true;
-                    break;
-                } else {
-                    char c = ss.popNext();
-                    if (c == '\\') {
-                        escape = true;
-                    } else {
-                        escape = false;
-                    }
-                    text += c;
-                }
-            }
-            if (!complete) {
-                panic("lexer", "incomplete string literal", startsl);
+        } else if (c == '"') {
+            kind = TokenKind::string;
+            pos = findClosingQuote(source, pos + 1);
+            if (pos == n) {
+                panic("lexer", "incomplete string literal", SourceLocator(source).locate(start));
             }
+            pos++;
         // variable / keyword
-        } else if (std::isalpha(ss.peekNext()) || ss.peekNext() == '_') {
-            while (
-                ss.hasNext() && (
-                    std::isalpha(ss.peekNext()) ||
-                    std::isdigit(ss.peekNext()) ||
-                    ss.peekNext() == '_'
-                )
-            ) {
-               text += ss.popNext();
+        } else if (isAlphaChar(c) || c == '_') {
+            kind = TokenKind::identifier;
+            while (pos < n && (isAlphaChar(source[pos]) || isDigitChar(source[pos]) || source[pos] == '_')) {
+                pos++;
             }
+            symbol = symbols.intern(source.substr(start, pos - start));
         // intrinsic
-        } else if (ss.peekNext() == '.') {
-            while (ss.hasNext() && !(std::isspace(ss.peekNext()) || ss.peekNext() == ')')) {
-                text += ss.popNext();
+        } else if (c == '.') {
+            kind = TokenKind::intrinsic;
+            while (pos < n && !(isSpaceChar(source[pos]) || source[pos] == ')')) {
+                pos++;
             }
         // special symbol
-        } else if (std::string("(){}@").find(ss.peekNext()) != std::string::npos) {
-            text += ss.popNext();
-        // comment
-        } else if (ss.peekNext() == '#') {
-            while (ss.hasNext() && ss.peekNext() != '\n') {
-                ss.popNext();
-            }
-            // nextToken() will consume the \n and recursively continue
-            return nextToken();
-        } else {
-            panic("lexer", "unsupported starting character", startsl);
-        }
-        return Token(startsl, std::move(text));
-    };
-
-    std::deque<Token> tokens;
-    while (true) {
-        auto ret = nextToken();
-        if (ret.has_value()) {
-            tokens.push_back(ret.value());
+        } else if (c == '(') {
+            kind = TokenKind::leftParen;
+            pos++;
+        } else if (c == ')') {
+            kind = TokenKind::rightParen;
+            pos++;
+        } else if (c == '{') {
+            kind = TokenKind::leftBrace;
+            pos++;
+        } else if (c == '}') {
+            kind = TokenKind::rightBrace;
+            pos++;
+        } else if (c == '@') {
+            kind = TokenKind::at;
+            pos++;
         } else {
-            break;
+            panic("lexer", "unsupported starting character", SourceLocator(source).locate(start));
         }
+        return Token{
+            kind,
+            static_cast<std::uint32_t>(start),
+            static_cast<std::uint32_t>(pos - start),
+            symbol
+        };
     }
-    return tokens;
-}
+private:
+    std::string_view source;
+    SymbolTable &symbols;
+    std::size_t pos = 0;
+};
 
 // ------------------------------
 // AST, parser, and static analysis
 // ------------------------------
 
-enum class TraversalMode {
-    topDown,
-    bottomUp
+// one tag per node type, for constant-cost dispatch
+enum class NodeKind : std::uint8_t {
+    integerNode,
+    stringNode,
+    variableNode,
+    lambdaNode,
+    letrecNode,
+    ifNode,
+    sequenceNode,
+    intrinsicCallNode,
+    exprCallNode,
+    atNode
 };
 
-// this also prevents implicitly-declared move constructors and move assignment operators
-#define DELETE_COPY(CLASS)\
-    CLASS(const CLASS &) = delete;\
-    CLASS &operator=(const CLASS &) = delete
-
-struct ExprNode {
-    DELETE_COPY(ExprNode);
-    virtual ~ExprNode() {}
-    ExprNode(SourceLocation s): sl(s) {}
-
-    virtual ExprNode *clone() const = 0;
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback  // callback may have states
-    ) = 0;
-    virtual std::string toString() const = 0;
-    virtual void computeFreeVars() = 0;
-    virtual void computeTail(bool parentTail) = 0;
+// index into Ast::nodes (-1 means none)
+using NodeId = std::int32_t;
 
-    SourceLocation sl;
-    std::unordered_set<std::string> freeVars;
+// the meaning of the fields depends on the kind;
+// (a, b) is a range [a, a + b) of Ast::lists when the node has a variable number of children
+//   integerNode / stringNode: a = offset of the raw literal in Ast::text, b = its length,
+//                             c = its pre-allocated location (raw word)
+//   variableNode: a = symbol, b = slot in the env of the current frame (-1 means undefined)
+//   lambdaNode: (a, b) = parameters, c = body, d = index into Ast::lambdas
+//   letrecNode: (a, b) = interleaved (variable, expression) pairs, c = body
+//   ifNode: a = condition, b = then-branch, c = else-branch
+//   sequenceNode: (a, b) = expressions
+//   intrinsicCallNode: (a, b) = arguments, c = symbol of the name, d = index into the intrinsic table
+//   exprCallNode: (a, b) = arguments, c = callee
+//   atNode: a = variable, b = expression
+struct Node {
+    NodeKind kind;
     bool tail = false;
+    SourceLocation sl;
+    std::int32_t a = -1;
+    std::int32_t b = -1;
+    std::int32_t c = -1;
+    std::int32_t d = -1;
 };
 
-// every value is accessed by reference to its location on the heap 
-using Location = int;
-
-struct IntegerNode : public ExprNode {
-    DELETE_COPY(IntegerNode);
-    virtual ~IntegerNode() {}
-    IntegerNode(SourceLocation s, std::string v): ExprNode(s), val(std::move(v)) {}
-
-    // covariant return type
-    virtual IntegerNode *clone() const override {
-        auto inode = new IntegerNode(sl, val);
-        inode->freeVars = freeVars;
-        inode->tail = tail;
-        return inode;
-    }
-    virtual void traverse(
-        TraversalMode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        callback(this);
-    }
-    virtual std::string toString() const override {
-        return val;
-    }
-    virtual void computeFreeVars() override {
-    }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-    }
-
-    std::string val;
-    Location loc = -1;
+// captured variable of a lambda: its symbol (for @) and its slot in the enclosing frame
+struct Capture {
+    Symbol name;
+    std::int32_t slot;
 };
 
-struct StringNode : public ExprNode {
-    DELETE_COPY(StringNode);
-    virtual ~StringNode() {}
-    StringNode(SourceLocation s, std::string v): ExprNode(s), val(std::move(v)) {}
+struct LambdaInfo {
+    NodeId node;
+    // range of Ast::captures (in the order of the closure env)
+    std::int32_t captureBegin = 0;
+    std::int32_t captureCount = 0;
+    // index of the compiled body (bytecode engine only)
+    std::int32_t chunk = -1;
+};
 
-    // covariant return type
-    virtual StringNode *clone() const override {
-        auto snode = new StringNode(sl, val);
-        snode->freeVars = freeVars;
-        snode->tail = tail;
-        return snode;
+// the whole tree lives in a few flat arrays of trivially copyable records, addressed by 32-bit indices;
+// children are always added before their parents, so the root is the last node,
+// a forward scan visits children first, and a backward scan visits parents first
+struct Ast {
+    NodeId add(Node node) {
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+    std::span<const NodeId> list(const Node &node) const {
+        return std::span<const NodeId>(lists).subspan(node.a, node.b);
     }
-    virtual void traverse(
-        TraversalMode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        callback(this);
+    std::span<const Capture> captureList(const LambdaInfo &info) const {
+        return std::span<const Capture>(captures).subspan(info.captureBegin, info.captureCount);
     }
-    virtual std::string toString() const override {
-        return val;
+    std::string_view literal(const Node &node) const {
+        return std::string_view(text).substr(node.a, node.b);
     }
-    virtual void computeFreeVars() override {
+    NodeId root() const {
+        return nodes.size() - 1;
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
+    std::string toString(NodeId id, const SymbolTable &symbols) const {
+        const auto &node = nodes[id];
+        auto join = [&](std::string_view open, std::span<const NodeId> ids, std::string_view close) {
+            std::string ret(open);
+            for (auto i : ids) {
+                if (ret.size() > open.size()) {
+                    ret += " ";
+                }
+                ret += toString(i, symbols);
+            }
+            return ret + std::string(close);
+        };
+        switch (node.kind) {
+            case NodeKind::integerNode:
+            case NodeKind::stringNode:
+                return std::string(literal(node));
+            case NodeKind::variableNode:
+                return symbols.name(node.a);
+            case NodeKind::lambdaNode:
+                return join("lambda (", list(node), ") ") + toString(node.c, symbols);
+            case NodeKind::letrecNode:
+                return join("letrec (", list(node), ") ") + toString(node.c, symbols);
+            case NodeKind::ifNode:
+                return "if " + toString(node.a, symbols) + " " + toString(node.b, symbols) + " " +
+                       toString(node.c, symbols);
+            case NodeKind::sequenceNode:
+                return join("{", list(node), "}");
+            case NodeKind::intrinsicCallNode:
+                return join("(" + symbols.name(node.c) + (node.b ? " " : ""), list(node), ")");
+            case NodeKind::exprCallNode:
+                return join("(" + toString(node.c, symbols) + (node.b ? " " : ""), list(node), ")");
+            case NodeKind::atNode:
+                return "@ " + toString(node.a, symbols) + " " + toString(node.b, symbols);
+            default:
+                return "";
+        }
     }
 
-    std::string val;
-    Location loc = -1;
+    std::vector<Node> nodes;
+    std::vector<NodeId> lists;
+    // raw literal tokens (strings are unquoted at pre-allocation)
+    std::string text;
+    std::vector<LambdaInfo> lambdas;
+    std::vector<Capture> captures;
 };
 
-struct VariableNode : public ExprNode {
-    DELETE_COPY(VariableNode);
-    virtual ~VariableNode() {}
-    VariableNode(SourceLocation s, std::string n): ExprNode(s), name(std::move(n)) {}
+static_assert(std::is_trivially_copyable_v<Node>);
+static_assert(std::is_trivially_copyable_v<Capture>);
+static_assert(std::is_trivially_copyable_v<LambdaInfo>);
+
+// recursive-descent parser pulling tokens from the lexer with (at most) two tokens of lookahead
+class Parser {
+public:
+    Parser(std::string_view s, SymbolTable &y, Ast &a): source(s), symbols(y), ast(a), lexer(s, y), locator(s) {}
 
-    virtual VariableNode *clone() const override {
-        auto vnode = new VariableNode(sl, name);
-        vnode->freeVars = freeVars;
-        vnode->tail = tail;
-        return vnode;
+    NodeId parse() {
+        auto expr = _parseExpr();
+        if (_peek()) {
+            panic("parser", "redundant token(s)", _locate(*_peek()));
+        }
+        return expr;
     }
-    virtual void traverse(
-        TraversalMode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        callback(this);
+private:
+    const Token *_peek(int k = 0) {
+        while (buffered <= k) {
+            lookahead[buffered] = lexer.next();
+            if (!lookahead[buffered].has_value()) {
+                return nullptr;
+            }
+            buffered++;
+        }
+        return &lookahead[k].value();
     }
-    virtual std::string toString() const override {
-        return name;
+    bool _peekKind(TokenKind kind, int k = 0) {
+        auto token = _peek(k);
+        return token && token->kind == kind;
     }
-    virtual void computeFreeVars() override {
-        freeVars.insert(name);
+    bool _isKeyword(const Token &token, std::string_view keyword) const {
+        return token.kind == TokenKind::identifier && token.text(source) == keyword;
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
+    // tokens are located in order, so the locator only ever scans forward
+    SourceLocation _locate(const Token &token) {
+        return locator.locate(token.offset);
     }
-
-    std::string name;
-};
-
-struct LambdaNode : public ExprNode {
-    DELETE_COPY(LambdaNode);
-    virtual ~LambdaNode() {
-        for (auto v : varList) {
-            delete v;
-        }
-        delete expr;
-    }
-    LambdaNode(SourceLocation s, std::vector<VariableNode*> v, ExprNode *e):
-        ExprNode(s), varList(std::move(v)), expr(e) {}
-
-    virtual LambdaNode *clone() const override {
-        std::vector<VariableNode*> newVarList;
-        for (auto v : varList) {
-            newVarList.push_back(v->clone());
-        }
-        ExprNode *newExpr = expr->clone();
-        auto lnode = new LambdaNode(sl, std::move(newVarList), newExpr);
-        lnode->freeVars = freeVars;
-        lnode->tail = tail;
-        return lnode;
-    }
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        if (mode == TraversalMode::topDown) {
-            callback(this);
-            _traverseSubtree(mode, callback);
-        } else {
-            _traverseSubtree(mode, callback);
-            callback(this);
+    Token _next() {
+        if (!_peek()) {
+            panic("parser", "incomplete token stream");
         }
+        Token token = *lookahead[0];
+        lookahead[0] = lookahead[1];
+        buffered--;
+        return token;
     }
-    virtual std::string toString() const override {
-        std::string ret = "lambda (";
-        for (auto v : varList) {
-            ret += v->toString();
-            ret += " ";
+    std::pair<Token, SourceLocation> _consume(TokenKind kind) {
+        auto token = _next();
+        auto sl = _locate(token);
+        if (token.kind != kind) {
+            panic("parser", "unexpected token", sl);
         }
-        if (ret.back() == ' ') {
-            ret.pop_back();
-        }
-        ret += ") ";
-        ret += expr->toString();
-        return ret;
+        return {token, sl};
     }
-    virtual void computeFreeVars() override {
-        expr->computeFreeVars();
-        freeVars.insert(expr->freeVars.begin(), expr->freeVars.end());
-        for (auto var : varList) {
-            freeVars.erase(var->name);
+    SourceLocation _consumeKeyword(std::string_view keyword) {
+        auto token = _next();
+        auto sl = _locate(token);
+        if (!_isKeyword(token, keyword)) {
+            panic("parser", "unexpected token", sl);
         }
+        return sl;
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-        for (auto var : varList) {
-            var->computeTail(false);
-        }
-        expr->computeTail(true);
+    // children of list nodes are collected on a shared stack (nested lists stay above their parents'),
+    // and moved to Ast::lists as one contiguous range when the list is complete
+    std::pair<std::int32_t, std::int32_t> _popList(std::size_t base) {
+        std::int32_t begin = ast.lists.size();
+        ast.lists.insert(ast.lists.end(), pending.begin() + base, pending.end());
+        pending.resize(base);
+        return {begin, static_cast<std::int32_t>(ast.lists.size()) - begin};
     }
 
-    std::vector<VariableNode*> varList;
-    ExprNode *expr;
-private:
-    void _traverseSubtree(TraversalMode mode, std::function<void(ExprNode*)> &callback) {
-        for (auto var : varList) {
-            var->traverse(mode, callback);
-        }
-        expr->traverse(mode, callback);
+    NodeId _parseLiteral(TokenKind kind, NodeKind nodeKind) {
+        auto [token, sl] = _consume(kind);
+        std::int32_t offset = ast.text.size();
+        ast.text += token.text(source);
+        return ast.add(Node{.kind = nodeKind, .sl = sl, .a = offset, .b = static_cast<std::int32_t>(token.length)});
     }
-};
-
-struct LetrecNode : public ExprNode {
-    DELETE_COPY(LetrecNode);
-    virtual ~LetrecNode() {
-        for (auto &ve : varExprList) {
-            delete ve.first;
-            delete ve.second;
-        }
-        delete expr;
-    }
-    LetrecNode(SourceLocation s, std::vector<std::pair<VariableNode*, ExprNode*>> v, ExprNode *e):
-        ExprNode(s), varExprList(std::move(v)), expr(e) {}
-
-    virtual LetrecNode *clone() const override {
-        std::vector<std::pair<VariableNode*, ExprNode*>> newVarExprList;
-        for (const auto &ve : varExprList) {
-            // the evaluation order of the two clones are irrelevant
-            newVarExprList.push_back(std::make_pair(ve.first->clone(), ve.second->clone()));
-        }
-        ExprNode *newExpr = expr->clone();
-        auto lnode = new LetrecNode(sl, std::move(newVarExprList), newExpr);
-        lnode->freeVars = freeVars;
-        lnode->tail = tail;
-        return lnode;
-    }
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        if (mode == TraversalMode::topDown) {
-            callback(this);
-            _traverseSubtree(mode, callback);
-        } else {
-            _traverseSubtree(mode, callback);
-            callback(this);
-        }
+    NodeId _parseVariable() {
+        auto [token, sl] = _consume(TokenKind::identifier);
+        return ast.add(Node{.kind = NodeKind::variableNode, .sl = sl, .a = static_cast<std::int32_t>(token.symbol)});
     }
-    virtual std::string toString() const override {
-        std::string ret = "letrec (";
-        for (const auto &ve : varExprList) {
-            ret += ve.first->toString();
-            ret += " ";
-            ret += ve.second->toString();
-            ret += " ";
-        }
-        if (ret.back() == ' ') {
-            ret.pop_back();
+    NodeId _parseLambda() {
+        auto start = _consumeKeyword("lambda");
+        _consume(TokenKind::leftParen);
+        auto base = pending.size();
+        while (_peekKind(TokenKind::identifier)) {
+            pending.push_back(_parseVariable());
         }
-        ret += ") ";
-        ret += expr->toString();
-        return ret;
+        _consume(TokenKind::rightParen);
+        auto expr = _parseExpr();
+        auto [begin, count] = _popList(base);
+        std::int32_t info = ast.lambdas.size();
+        auto id = ast.add(Node{.kind = NodeKind::lambdaNode, .sl = start, .a = begin, .b = count, .c = expr, .d = info});
+        ast.lambdas.push_back(LambdaInfo{.node = id});
+        return id;
     }
-    virtual void computeFreeVars() override {
-        expr->computeFreeVars();
-        freeVars.insert(expr->freeVars.begin(), expr->freeVars.end());
-        for (auto &ve : varExprList) {
-            ve.second->computeFreeVars();
-            freeVars.insert(ve.second->freeVars.begin(), ve.second->freeVars.end());
-        }
-        for (auto &ve : varExprList) {
-            freeVars.erase(ve.first->name);
+    NodeId _parseLetrec() {
+        auto start = _consumeKeyword("letrec");
+        _consume(TokenKind::leftParen);
+        auto base = pending.size();
+        while (_peekKind(TokenKind::identifier)) {
+            // enforce the evaluation order of v; e
+            auto v = _parseVariable();
+            pending.push_back(v);
+            auto e = _parseExpr();
+            pending.push_back(e);
         }
+        _consume(TokenKind::rightParen);
+        auto expr = _parseExpr();
+        auto [begin, count] = _popList(base);
+        return ast.add(Node{.kind = NodeKind::letrecNode, .sl = start, .a = begin, .b = count, .c = expr});
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-        for (auto &ve : varExprList) {
-            ve.first->computeTail(false);
-            ve.second->computeTail(false);
-        }
-        expr->computeTail(tail);
+    NodeId _parseIf() {
+        auto start = _consumeKeyword("if");
+        auto cond = _parseExpr();
+        auto branch1 = _parseExpr();
+        auto branch2 = _parseExpr();
+        return ast.add(Node{.kind = NodeKind::ifNode, .sl = start, .a = cond, .b = branch1, .c = branch2});
     }
-    
-    std::vector<std::pair<VariableNode*, ExprNode*>> varExprList;
-    ExprNode *expr;
-private:
-    void _traverseSubtree(TraversalMode mode, std::function<void(ExprNode*)> &callback) {
-        for (auto &ve : varExprList) {
-            ve.first->traverse(mode, callback);
-            ve.second->traverse(mode, callback);
+    NodeId _parseSequence() {
+        auto start = _consume(TokenKind::leftBrace).second;
+        auto base = pending.size();
+        while (_peek() && !_peekKind(TokenKind::rightBrace)) {
+            pending.push_back(_parseExpr());
         }
-        expr->traverse(mode, callback);
+        if (pending.size() == base) {
+            panic("parser", "zero-length sequence", start);
+        }
+        _consume(TokenKind::rightBrace);
+        auto [begin, count] = _popList(base);
+        return ast.add(Node{.kind = NodeKind::sequenceNode, .sl = start, .a = begin, .b = count});
     }
-};
-
-struct IfNode : public ExprNode {
-    DELETE_COPY(IfNode);
-    virtual ~IfNode() {
-        delete cond;
-        delete branch1;
-        delete branch2;
-    }
-    IfNode(SourceLocation s, ExprNode *c, ExprNode *b1, ExprNode *b2):
-        ExprNode(s), cond(c), branch1(b1), branch2(b2) {}
-
-    virtual IfNode *clone() const override {
-        // the evaluation order of the three clones are irrelevant
-        auto inode = new IfNode(sl, cond->clone(), branch1->clone(), branch2->clone());
-        inode->freeVars = freeVars;
-        inode->tail = tail;
-        return inode;
-    }
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        if (mode == TraversalMode::topDown) {
-            callback(this);
-            _traverseSubtree(mode, callback);
-        } else {
-            _traverseSubtree(mode, callback);
-            callback(this);
+    NodeId _parseIntrinsicCall() {
+        auto start = _consume(TokenKind::leftParen).second;
+        auto intrinsic = _consume(TokenKind::intrinsic).first;
+        auto base = pending.size();
+        while (_peek() && !_peekKind(TokenKind::rightParen)) {
+            pending.push_back(_parseExpr());
         }
+        _consume(TokenKind::rightParen);
+        auto [begin, count] = _popList(base);
+        auto name = static_cast<std::int32_t>(symbols.intern(intrinsic.text(source)));
+        return ast.add(Node{.kind = NodeKind::intrinsicCallNode, .sl = start, .a = begin, .b = count, .c = name});
     }
-    virtual std::string toString() const override {
-        return "if " + cond->toString() + " " + branch1->toString() + " " + branch2->toString();
+    NodeId _parseExprCall() {
+        auto start = _consume(TokenKind::leftParen).second;
+        auto expr = _parseExpr();
+        auto base = pending.size();
+        while (_peek() && !_peekKind(TokenKind::rightParen)) {
+            pending.push_back(_parseExpr());
+        }
+        _consume(TokenKind::rightParen);
+        auto [begin, count] = _popList(base);
+        return ast.add(Node{.kind = NodeKind::exprCallNode, .sl = start, .a = begin, .b = count, .c = expr});
     }
-    virtual void computeFreeVars() override {
-        cond->computeFreeVars();
-        freeVars.insert(cond->freeVars.begin(), cond->freeVars.end());
-        branch1->computeFreeVars();
-        freeVars.insert(branch1->freeVars.begin(), branch1->freeVars.end());
-        branch2->computeFreeVars();
-        freeVars.insert(branch2->freeVars.begin(), branch2->freeVars.end());
+    NodeId _parseAt() {
+        auto start = _consume(TokenKind::at).second;
+        auto var = _parseVariable();
+        auto expr = _parseExpr();
+        return ast.add(Node{.kind = NodeKind::atNode, .sl = start, .a = var, .b = expr});
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-        cond->computeTail(false);
-        branch1->computeTail(tail);
-        branch2->computeTail(tail);
+    NodeId _parseExpr() {
+        auto token = _peek();
+        if (!token) {
+            panic("parser", "incomplete token stream");
+            return -1;
+        }
+        switch (token->kind) {
+            case TokenKind::integer:
+                return _parseLiteral(TokenKind::integer, NodeKind::integerNode);
+            case TokenKind::string:  // don't unquote here: AST keeps raw tokens
+                return _parseLiteral(TokenKind::string, NodeKind::stringNode);
+            // check keywords before var to avoid recognizing keywords as vars
+            case TokenKind::identifier:
+                if (_isKeyword(*token, "lambda")) {
+                    return _parseLambda();
+                } else if (_isKeyword(*token, "letrec")) {
+                    return _parseLetrec();
+                } else if (_isKeyword(*token, "if")) {
+                    return _parseIf();
+                }
+                return _parseVariable();
+            case TokenKind::leftBrace:
+                return _parseSequence();
+            case TokenKind::leftParen:
+                if (!_peek(1)) {
+                    panic("parser", "incomplete token stream");
+                    return -1;
+                }
+                if (_peekKind(TokenKind::intrinsic, 1)) {
+                    return _parseIntrinsicCall();
+                } else {
+                    return _parseExprCall();
+                }
+            case TokenKind::at:
+                return _parseAt();
+            default:
+                panic("parser", "unrecognized token", _locate(*token));
+                return -1;
+        }
     }
 
-    ExprNode *cond;
-    ExprNode *branch1;
-    ExprNode *branch2;
-private:
-    void _traverseSubtree(TraversalMode mode, std::function<void(ExprNode*)> &callback) {
-        cond->traverse(mode, callback);
-        branch1->traverse(mode, callback);
-        branch2->traverse(mode, callback);
-    }
+    std::string_view source;
+    SymbolTable &symbols;
+    Ast &ast;
+    Lexer lexer;
+    SourceLocator locator;
+    std::optional<Token> lookahead[2];
+    int buffered = 0;
+    std::vector<NodeId> pending;
 };
 
-struct SequenceNode : public ExprNode {
-    DELETE_COPY(SequenceNode);
-    virtual ~SequenceNode() {
-        for (auto e : exprList) {
-            delete e;
-        }
-    }
-    SequenceNode(SourceLocation s, std::vector<ExprNode*> e):
-        ExprNode(s), exprList(std::move(e)) {}
-
-    virtual SequenceNode *clone() const override {
-        std::vector<ExprNode*> newExprList;
-        for (auto e : exprList) {
-            newExprList.push_back(e->clone());
-        }
-        auto snode = new SequenceNode(sl, std::move(newExprList));
-        snode->freeVars = freeVars;
-        snode->tail = tail;
-        return snode;
-    }
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        if (mode == TraversalMode::topDown) {
-            callback(this);
-            _traverseSubtree(mode, callback);
-        } else {
-            _traverseSubtree(mode, callback);
-            callback(this);
-        }
-    }
-    virtual std::string toString() const override {
-        std::string ret = "{";
-        for (auto e : exprList) {
-            ret += e->toString();
-            ret += " ";
-        }
-        if (ret.back() == ' ') {
-            ret.pop_back();
+void checkDuplicates(const Ast &ast) {
+    std::unordered_set<Symbol> varNames;
+    for (const auto &node : ast.nodes) {
+        if (node.kind != NodeKind::lambdaNode && node.kind != NodeKind::letrecNode) {
+            continue;
         }
-        ret += "}";
-        return ret;
-    }
-    virtual void computeFreeVars() override {
-        for (auto e : exprList) {
-            e->computeFreeVars();
-            freeVars.insert(e->freeVars.begin(), e->freeVars.end());
-        }
-    }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-        int n = exprList.size();
-        for (int i = 0; i < n - 1; i++) {
-            exprList[i]->computeTail(false);
+        varNames.clear();
+        auto ids = ast.list(node);
+        // letrec lists interleave variables and expressions
+        int stride = node.kind == NodeKind::letrecNode ? 2 : 1;
+        for (std::size_t i = 0; i < ids.size(); i += stride) {
+            Symbol name = ast.nodes[ids[i]].a;
+            if (varNames.contains(name)) {
+                panic(
+                    "sema",
+                    node.kind == NodeKind::lambdaNode ? "duplicate parameter names" : "duplicate binding names",
+                    node.sl
+                );
+            }
+            varNames.insert(name);
         }
-        exprList[n - 1]->computeTail(tail);
     }
+}
 
-    std::vector<ExprNode*> exprList;
-private:
-    void _traverseSubtree(TraversalMode mode, std::function<void(ExprNode*)> &callback) {
-        for (auto e : exprList) {
-            e->traverse(mode, callback);
+// parents precede children in a backward scan
+void computeTail(Ast &ast) {
+    auto &nodes = ast.nodes;
+    for (NodeId id = ast.root(); id >= 0; id--) {
+        // the tail flags of children are false by default
+        const auto &node = nodes[id];
+        switch (node.kind) {
+            case NodeKind::lambdaNode:
+                nodes[node.c].tail = true;
+                break;
+            case NodeKind::letrecNode:
+            case NodeKind::ifNode:
+                nodes[node.c].tail = node.tail;
+                if (node.kind == NodeKind::ifNode) {
+                    nodes[node.b].tail = node.tail;
+                }
+                break;
+            case NodeKind::sequenceNode:
+                nodes[ast.list(node).back()].tail = node.tail;
+                break;
+            default:
+                break;
         }
     }
-};
+}
 
-struct IntrinsicCallNode : public ExprNode {
-    DELETE_COPY(IntrinsicCallNode);
-    virtual ~IntrinsicCallNode() {
-        for (auto a : argList) {
-            delete a;
-        }
-    }
-    IntrinsicCallNode(SourceLocation s, std::string i, std::vector<ExprNode*> a):
-        ExprNode(s), intrinsic(std::move(i)), argList(std::move(a)) {}
-
-    virtual IntrinsicCallNode *clone() const override {
-        std::vector<ExprNode*> newArgList;
-        for (auto a : argList) {
-            newArgList.push_back(a->clone());
-        }
-        auto inode = new IntrinsicCallNode(sl, intrinsic, std::move(newArgList));
-        inode->freeVars = freeVars;
-        inode->tail = tail;
-        return inode;
-    }
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        if (mode == TraversalMode::topDown) {
-            callback(this);
-            _traverseSubtree(mode, callback);
-        } else {
-            _traverseSubtree(mode, callback);
-            callback(this);
+// free variables of each lambda as sorted symbol vectors (indexed like Ast::lambdas);
+// children precede parents in a forward scan, and each child's set is released once merged into its parent,
+// so only the sets of the nodes whose parents are still pending are alive at any time
+std::vector<std::vector<Symbol>> computeFreeVars(const Ast &ast) {
+    std::vector<std::vector<Symbol>> freeVars(ast.nodes.size());
+    std::vector<std::vector<Symbol>> lambdaFreeVars(ast.lambdas.size());
+    for (NodeId id = 0; id < static_cast<NodeId>(ast.nodes.size()); id++) {
+        const auto &node = ast.nodes[id];
+        auto &fv = freeVars[id];
+        auto merge = [&](NodeId child) {
+            auto &cfv = freeVars[child];
+            if (fv.empty()) {
+                fv.swap(cfv);
+            } else {
+                fv.insert(fv.end(), cfv.begin(), cfv.end());
+                std::vector<Symbol>().swap(cfv);
+            }
+        };
+        auto normalize = [&fv]() {
+            std::sort(fv.begin(), fv.end());
+            fv.erase(std::unique(fv.begin(), fv.end()), fv.end());
+        };
+        auto remove = [&](NodeId var) {
+            auto iter = std::lower_bound(fv.begin(), fv.end(), static_cast<Symbol>(ast.nodes[var].a));
+            if (iter != fv.end() && *iter == static_cast<Symbol>(ast.nodes[var].a)) {
+                fv.erase(iter);
+            }
+        };
+        switch (node.kind) {
+            case NodeKind::variableNode:
+                fv.push_back(node.a);
+                break;
+            case NodeKind::lambdaNode:
+                merge(node.c);
+                for (auto var : ast.list(node)) {
+                    remove(var);
+                }
+                lambdaFreeVars[node.d] = fv;
+                break;
+            case NodeKind::letrecNode: {
+                // letrec lists interleave variables and expressions
+                auto ids = ast.list(node);
+                for (std::size_t i = 1; i < ids.size(); i += 2) {
+                    merge(ids[i]);
+                }
+                merge(node.c);
+                normalize();
+                for (std::size_t i = 0; i < ids.size(); i += 2) {
+                    remove(ids[i]);
+                }
+                break;
+            }
+            case NodeKind::ifNode:
+                merge(node.a);
+                merge(node.b);
+                merge(node.c);
+                normalize();
+                break;
+            case NodeKind::exprCallNode:
+                merge(node.c);
+                [[fallthrough]];
+            case NodeKind::sequenceNode:
+            case NodeKind::intrinsicCallNode:
+                for (auto e : ast.list(node)) {
+                    merge(e);
+                }
+                normalize();
+                break;
+            case NodeKind::atNode:
+                merge(node.b);
+                break;
+            default:
+                break;
         }
     }
-    virtual std::string toString() const override {
-        std::string ret = "(" + intrinsic;
-        for (auto a : argList) {
-            ret += " ";
-            ret += a->toString();
+    return lambdaFreeVars;
+}
+
+// resolves each variable to a slot index of the env of the current frame,
+// and each lambda to its capture list (the slots to copy into the closure, in env order)
+class SlotResolver {
+public:
+    SlotResolver(Ast &a, std::size_t numSymbols, std::vector<std::vector<Symbol>> f):
+        ast(a), freeVars(std::move(f)), newest(numSymbols, -1) {}
+
+    void resolve(NodeId id) {
+        auto &node = ast.nodes[id];
+        switch (node.kind) {
+            case NodeKind::variableNode:
+                node.b = newest[node.a];
+                break;
+            case NodeKind::lambdaNode: {
+                // capture the newest binding of each free variable, keeping the env order
+                // (closure size optimization: unused variables are omitted)
+                auto &info = ast.lambdas[node.d];
+                info.captureBegin = ast.captures.size();
+                for (auto name : freeVars[node.d]) {
+                    if (newest[name] >= 0) {
+                        ast.captures.push_back(Capture{name, newest[name]});
+                    }
+                }
+                info.captureCount = ast.captures.size() - info.captureBegin;
+                auto captures = ast.captures.begin() + info.captureBegin;
+                std::sort(captures, ast.captures.end(), [](const Capture &c1, const Capture &c2) {
+                    return c1.slot < c2.slot;
+                });
+                // the new frame's env: captured variables followed by parameters
+                auto outer = std::move(scope);
+                auto mark = shadowed.size();
+                for (auto name : outer) {
+                    newest[name] = -1;
+                }
+                scope.clear();
+                for (const auto &capture : ast.captureList(info)) {
+                    _bind(capture.name);
+                }
+                for (auto var : ast.list(node)) {
+                    ast.nodes[var].b = _bind(ast.nodes[var].a);
+                }
+                resolve(node.c);
+                // restore the enclosing frame (later bindings shadow earlier ones)
+                for (auto name : scope) {
+                    newest[name] = -1;
+                }
+                shadowed.resize(mark);
+                scope = std::move(outer);
+                for (std::size_t i = 0; i < scope.size(); i++) {
+                    newest[scope[i]] = i;
+                }
+                break;
+            }
+            case NodeKind::letrecNode: {
+                auto ids = ast.list(node);
+                for (std::size_t i = 0; i < ids.size(); i += 2) {
+                    ast.nodes[ids[i]].b = _bind(ast.nodes[ids[i]].a);
+                }
+                for (std::size_t i = 1; i < ids.size(); i += 2) {
+                    resolve(ids[i]);
+                }
+                resolve(node.c);
+                _unbind(ids.size() / 2);
+                break;
+            }
+            case NodeKind::ifNode:
+                resolve(node.a);
+                resolve(node.b);
+                resolve(node.c);
+                break;
+            case NodeKind::sequenceNode:
+            case NodeKind::intrinsicCallNode:
+                for (auto e : ast.list(node)) {
+                    resolve(e);
+                }
+                break;
+            case NodeKind::exprCallNode:
+                resolve(node.c);
+                for (auto e : ast.list(node)) {
+                    resolve(e);
+                }
+                break;
+            case NodeKind::atNode:
+                // var is resolved at runtime among the closure's captured variables
+                resolve(node.b);
+                break;
+            default:
+                break;
         }
-        ret += ")";
-        return ret;
     }
-    virtual void computeFreeVars() override {
-        for (auto a : argList) {
-            a->computeFreeVars();
-            freeVars.insert(a->freeVars.begin(), a->freeVars.end());
-        }
+private:
+    std::int32_t _bind(Symbol name) {
+        std::int32_t slot = scope.size();
+        shadowed.push_back(newest[name]);
+        newest[name] = slot;
+        scope.push_back(name);
+        return slot;
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-        for (auto a : argList) {
-            a->computeTail(false);
+    void _unbind(std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            newest[scope.back()] = shadowed.back();
+            scope.pop_back();
+            shadowed.pop_back();
         }
     }
 
-    std::string intrinsic;
-    std::vector<ExprNode*> argList;
-private:
-    void _traverseSubtree(TraversalMode mode, std::function<void(ExprNode*)> &callback) {
-        for (auto a : argList) {
-            a->traverse(mode, callback);
-        }
-    }
+    Ast &ast;
+    std::vector<std::vector<Symbol>> freeVars;
+    // the symbols of the runtime env of the current frame
+    std::vector<Symbol> scope;
+    // (per symbol) the slot of its newest binding in the current frame, or -1
+    std::vector<std::int32_t> newest;
+    // (per binding in the current frame) the slot it shadows
+    std::vector<std::int32_t> shadowed;
 };
 
-struct ExprCallNode : public ExprNode {
-    DELETE_COPY(ExprCallNode);
-    virtual ~ExprCallNode() {
-        delete expr;
-        for (auto a : argList) {
-            delete a;
-        }
-    }
-    ExprCallNode(SourceLocation s, ExprNode *e, std::vector<ExprNode*> a):
-        ExprNode(s), expr(e), argList(std::move(a)) {}
-
-    virtual ExprCallNode *clone() const override {
-        ExprNode *newExpr = expr->clone();
-        std::vector<ExprNode*> newArgList;
-        for (auto a : argList) {
-            newArgList.push_back(a->clone());
-        }
-        auto enode = new ExprCallNode(sl, newExpr, std::move(newArgList));
-        enode->freeVars = freeVars;
-        enode->tail = tail;
-        return enode;
-    }
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        if (mode == TraversalMode::topDown) {
-            callback(this);
-            _traverseSubtree(mode, callback);
-        } else {
-            _traverseSubtree(mode, callback);
-            callback(this);
-        }
+// ------------------------------
+// bytecode
+// ------------------------------
+
+// the bytecode is accumulator-based (mirroring the AST interpreter's resultLoc):
+// every expression leaves its value in resultLoc,
+// and call arguments are pushed onto the locals of the current layer
+enum class OpCode {
+    literal,        // resultLoc = arg (raw word of the pre-allocated literal location)
+    variable,       // resultLoc = the variable's location
+    lambda,         // resultLoc = a new closure
+    push,           // push resultLoc onto the locals
+    letrecBegin,    // create the placeholder locations of the bindings
+    letrecBind,     // copy resultLoc into the placeholder at slot arg
+    letrecEnd,      // remove the bindings from the env
+    jumpIfFalse,    // jump to arg if resultLoc is integer 0
+    jump,           // jump to arg
+    intrinsicCall,  // call an intrinsic with the top arg locals
+    exprCall,       // call a closure with the top (arg + 1) locals
+    tailCall,       // same as exprCall, but replaces the current frame
+    at,             // resultLoc = a variable in the closure at resultLoc
+    ret             // finish the current chunk
+};
+
+struct Instruction {
+    OpCode op;
+    int arg;
+    // the originating AST node (for names, closures, and error locations)
+    NodeId node;
+};
+
+// compiled code of either the top-level expression or a lambda body
+struct Chunk {
+    std::vector<Instruction> code;
+};
+
+class Compiler {
+public:
+    // chunk 0 is the top-level expression;
+    // this also records the chunk of each lambda in Ast::lambdas
+    // literal locations must be pre-allocated before compilation
+    std::vector<Chunk> compile(Ast &a) {
+        ast = &a;
+        chunks.clear();
+        _compileChunk(ast->root());
+        return std::move(chunks);
     }
-    virtual std::string toString() const override {
-        std::string ret = "(" + expr->toString();
-        for (auto a : argList) {
-            ret += " ";
-            ret += a->toString();
-        }
-        ret += ")";
-        return ret;
+private:
+    int _compileChunk(NodeId e) {
+        int c = chunks.size();
+        chunks.emplace_back();
+        _compile(c, e);
+        _emit(c, OpCode::ret, 0, e);
+        return c;
     }
-    virtual void computeFreeVars() override {
-        expr->computeFreeVars();
-        freeVars.insert(expr->freeVars.begin(), expr->freeVars.end());
-        for (auto a : argList) {
-            a->computeFreeVars();
-            freeVars.insert(a->freeVars.begin(), a->freeVars.end());
-        }
+    int _emit(int c, OpCode op, int arg, NodeId node) {
+        chunks[c].code.push_back(Instruction{op, arg, node});
+        return chunks[c].code.size() - 1;
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-        expr->computeTail(false);
-        for (auto a : argList) {
-            a->computeTail(false);
-        }
+    int _here(int c) const {
+        return chunks[c].code.size();
     }
-
-    ExprNode *expr;
-    std::vector<ExprNode*> argList;
-private:
-    void _traverseSubtree(TraversalMode mode, std::function<void(ExprNode*)> &callback) {
-        expr->traverse(mode, callback);
-        for (auto a : argList) {
-            a->traverse(mode, callback);
+    void _compile(int c, NodeId e) {
+        const auto &node = ast->nodes[e];
+        switch (node.kind) {
+            case NodeKind::integerNode:
+            case NodeKind::stringNode:
+                _emit(c, OpCode::literal, node.c, e);
+                break;
+            case NodeKind::variableNode:
+                _emit(c, OpCode::variable, 0, e);
+                break;
+            case NodeKind::lambdaNode: {
+                int chunk = _compileChunk(node.c);
+                ast->lambdas[node.d].chunk = chunk;
+                _emit(c, OpCode::lambda, 0, e);
+                break;
+            }
+            case NodeKind::letrecNode: {
+                auto ids = ast->list(node);
+                _emit(c, OpCode::letrecBegin, 0, e);
+                for (std::size_t i = 1; i < ids.size(); i += 2) {
+                    _compile(c, ids[i]);
+                    _emit(c, OpCode::letrecBind, ast->nodes[ids[i - 1]].b, e);
+                }
+                _compile(c, node.c);
+                _emit(c, OpCode::letrecEnd, 0, e);
+                break;
+            }
+            case NodeKind::ifNode: {
+                _compile(c, node.a);
+                int toBranch2 = _emit(c, OpCode::jumpIfFalse, -1, e);
+                _compile(c, node.b);
+                int toEnd = _emit(c, OpCode::jump, -1, e);
+                chunks[c].code[toBranch2].arg = _here(c);
+                _compile(c, node.c);
+                chunks[c].code[toEnd].arg = _here(c);
+                break;
+            }
+            case NodeKind::sequenceNode:
+                for (auto e1 : ast->list(node)) {
+                    _compile(c, e1);
+                }
+                break;
+            case NodeKind::intrinsicCallNode:
+                for (auto a : ast->list(node)) {
+                    _compile(c, a);
+                    _emit(c, OpCode::push, 0, a);
+                }
+                _emit(c, OpCode::intrinsicCall, node.b, e);
+                break;
+            case NodeKind::exprCallNode:
+                _compile(c, node.c);
+                _emit(c, OpCode::push, 0, node.c);
+                for (auto a : ast->list(node)) {
+                    _compile(c, a);
+                    _emit(c, OpCode::push, 0, a);
+                }
+                _emit(c, node.tail ? OpCode::tailCall : OpCode::exprCall, node.b, e);
+                break;
+            case NodeKind::atNode:
+                _compile(c, node.b);
+                _emit(c, OpCode::at, 0, e);
+                break;
+            default:
+                panic("compiler", "unrecognized AST node", node.sl);
         }
     }
+
+    Ast *ast = nullptr;
+    std::vector<Chunk> chunks;
 };
 
-struct AtNode : public ExprNode {
-    DELETE_COPY(AtNode);
-    virtual ~AtNode() {
-        delete var;
-        delete expr;
-    }
-    AtNode(SourceLocation s, VariableNode *v, ExprNode *e): ExprNode(s), var(v), expr(e) {}
-
-    virtual AtNode *clone() const override {
-        // the evaluation order of the two clones are irrelevant
-        auto anode = new AtNode(sl, var->clone(), expr->clone());
-        anode->freeVars = freeVars;
-        anode->tail = tail;
-        return anode;
-    }
-    virtual void traverse(
-        TraversalMode mode,
-        std::function<void(ExprNode*)> &callback
-    ) override {
-        if (mode == TraversalMode::topDown) {
-            callback(this);
-            _traverseSubtree(mode, callback);
-        } else {
-            _traverseSubtree(mode, callback);
-            callback(this);
-        }
+// the analyzed AST and (optionally) its bytecode;
+// this is immutable after construction and shared by copies of the runtime state
+struct Program {
+    Program() = default;
+    Program(const Program &) = delete;
+    Program &operator=(const Program &) = delete;
+
+    SymbolTable symbols;
+    Ast ast;
+    std::vector<Chunk> chunks;
+};
+
+// ------------------------------
+// runtime
+// ------------------------------
+
+// every value is accessed by reference to its location:
+// a tagged word holding either an immediate 31-bit integer (low bit 1) or the index of a heap cell (low bit 0)
+class Location {
+public:
+    static constexpr int MIN_IMMEDIATE = -(1 << 30);
+    static constexpr int MAX_IMMEDIATE = (1 << 30) - 1;
+
+    constexpr Location() = default;
+    static constexpr Location cell(int index) {
+        return fromRaw(static_cast<std::int32_t>(static_cast<std::uint32_t>(index) << 1));
     }
-    virtual std::string toString() const override {
-        return "@ " + var->toString() + " " + expr->toString();
+    // the caller must check fitsImmediate first
+    static constexpr Location immediate(int value) {
+        return fromRaw(static_cast<std::int32_t>((static_cast<std::uint32_t>(value) << 1) | 1));
     }
-    virtual void computeFreeVars() override {
-        expr->computeFreeVars();
-        freeVars.insert(expr->freeVars.begin(), expr->freeVars.end());
+    static constexpr bool fitsImmediate(std::int64_t value) {
+        return MIN_IMMEDIATE <= value && value <= MAX_IMMEDIATE;
     }
-    virtual void computeTail(bool parentTail) override {
-        tail = parentTail;
-        var->computeTail(false);
-        expr->computeTail(false);
+    static constexpr Location fromRaw(std::int32_t w) {
+        Location loc;
+        loc.word = w;
+        return loc;
     }
 
-    VariableNode *var;
-    ExprNode *expr;
+    bool isImmediate() const {
+        return word & 1;
+    }
+    int index() const {
+        return word >> 1;
+    }
+    int integer() const {
+        return word >> 1;
+    }
+    std::int32_t raw() const {
+        return word;
+    }
+    bool operator==(const Location &) const = default;
 private:
-    void _traverseSubtree(TraversalMode mode, std::function<void(ExprNode*)> &callback) {
-        var->traverse(mode, callback);
-        expr->traverse(mode, callback);
+    std::int32_t word = 0;
+};
+
+struct Void {
+    Void() = default;
+
+    std::string toString() const {
+        return "<void>";
     }
 };
 
-#undef DELETE_COPY
+// the inline representation of integers (the payload of a Value is 61 bits wide);
+// integers out of this range are BigInts, so every integer has exactly one representation
+struct Integer {
+    static constexpr std::int64_t MIN = -(std::int64_t(1) << 60);
+    static constexpr std::int64_t MAX = (std::int64_t(1) << 60) - 1;
 
-ExprNode *parse(std::deque<Token> tokens) {
-    auto isIntegerToken = [](const Token &token) {
-        return token.text.size() > 0 && (
-            std::isdigit(token.text[0]) ||
-            token.text[0] == '-' ||
-            token.text[0] == '+'
-        );
-    };
-    auto isStringToken = [](const Token &token) {
-        return token.text.size() > 0 && token.text[0] == '"';
-    };
-    auto isIntrinsicToken = [](const Token &token) {
-        return token.text.size() > 0 && token.text[0] == '.';
-    };
-    auto isVariableToken = [](const Token &token) {
-        return token.text.size() > 0 && (std::isalpha(token.text[0]) || token.text[0] == '_');
-    };
-    auto isTheToken = [](const std::string &s) {
-        return [s](const Token &token) {
-            return token.text == s;
-        };
-    };
-    auto consume = [&tokens]<typename Callable>(const Callable &predicate) -> Token {
-        if (tokens.size() == 0) {
-            panic("parser", "incomplete token stream");
+    // the caller must check fits first
+    Integer(std::int64_t v): value(v) {}
+
+    static constexpr bool fits(std::int64_t v) {
+        return MIN <= v && v <= MAX;
+    }
+    std::string toString() const {
+        return std::to_string(value);
+    }
+
+    std::int64_t value = 0;
+};
+
+// arbitrary-precision integers: a sign and a magnitude of little-endian 32-bit limbs (without leading zeros)
+class BigInt {
+public:
+    BigInt() = default;
+    BigInt(std::int64_t v): negative(v < 0) {
+        auto m = negative ? ~static_cast<std::uint64_t>(v) + 1 : static_cast<std::uint64_t>(v);
+        while (m != 0) {
+            limbs.push_back(static_cast<std::uint32_t>(m));
+            m >>= 32;
+        }
+    }
+
+    // digits must be non-empty and decimal
+    static BigInt parse(std::string_view digits, bool negative) {
+        return BigInt(negative, _parseMagnitude(digits));
+    }
+    std::optional<std::int64_t> toInt64() const {
+        if (limbs.size() > 2) {
+            return std::nullopt;
         }
-        auto token = tokens.front();
-        tokens.pop_front();
-        if (!predicate(token)) {
-            panic("parser", "unexpected token", token.sl);
+        std::uint64_t m = 0;
+        for (std::size_t i = limbs.size(); i-- > 0;) {
+            m = (m << 32) | limbs[i];
         }
-        return token;
-    };
+        if (!negative && m <= static_cast<std::uint64_t>(INT64_MAX)) {
+            return static_cast<std::int64_t>(m);
+        } else if (negative && m <= static_cast<std::uint64_t>(INT64_MAX) + 1) {
+            return static_cast<std::int64_t>(~m + 1);
+        }
+        return std::nullopt;
+    }
+    bool isNegative() const {
+        return negative;
+    }
+    std::size_t hash() const {
+        std::size_t h = negative ? 1 : 0;
+        for (auto limb : limbs) {
+            h = h * 0x100000001b3ull ^ limb;
+        }
+        return h;
+    }
+    std::string toString() const {
+        if (limbs.empty()) {
+            return "0";
+        }
+        std::string s = negative ? "-" : "";
+        _formatMagnitude(limbs, 0, s);
+        return s;
+    }
 
-    std::function<IntegerNode*()> parseInteger;
-    std::function<StringNode*()> parseString;
-    std::function<VariableNode*()> parseVariable;
-    std::function<LambdaNode*()> parseLambda;
-    std::function<LetrecNode*()> parseLetrec;
-    std::function<IfNode*()> parseIf;
-    std::function<SequenceNode*()> parseSequence;
-    std::function<IntrinsicCallNode*()> parseIntrinsicCall;
-    std::function<ExprCallNode*()> parseExprCall;
-    std::function<AtNode*()> parseAt;
-    std::function<ExprNode*()> parseExpr;
-
-    parseInteger = [&]() -> IntegerNode* {
-        auto token = consume(isIntegerToken);
-        return new IntegerNode(token.sl, token.text);
-    };
-    parseString = [&]() -> StringNode* {  // don't unquote here: AST keeps raw tokens
-        auto token = consume(isStringToken);
-        return new StringNode(token.sl, token.text);
-    };
-    parseVariable = [&]() -> VariableNode* {
-        auto token = consume(isVariableToken);
-        return new VariableNode(token.sl, std::move(token.text));
-    };
-    parseLambda = [&]() -> LambdaNode* {
-        auto start = consume(isTheToken("lambda"));
-        consume(isTheToken("("));
-        std::vector<VariableNode*> varList;
-        while (tokens.size() && isVariableToken(tokens[0])) {
-            varList.push_back(parseVariable());
-        }
-        consume(isTheToken(")"));
-        auto expr = parseExpr();
-        return new LambdaNode(start.sl, std::move(varList), expr);
-    };
-    parseLetrec = [&]() -> LetrecNode* {
-        auto start = consume(isTheToken("letrec"));
-        consume(isTheToken("("));
-        std::vector<std::pair<VariableNode*, ExprNode*>> varExprList;
-        while (tokens.size() && isVariableToken(tokens[0])) {
-            // enforce the evaluation order of v; e
-            auto v = parseVariable();
-            auto e = parseExpr();
-            varExprList.emplace_back(v, e);
+    static int compare(const BigInt &a, const BigInt &b) {
+        if (a.negative != b.negative) {
+            return a.negative ? -1 : 1;
         }
-        consume(isTheToken(")"));
-        auto expr = parseExpr();
-        return new LetrecNode(start.sl, std::move(varExprList), expr);
-    };
-    parseIf = [&]() -> IfNode* {
-        auto start = consume(isTheToken("if"));
-        auto cond = parseExpr();
-        auto branch1 = parseExpr();
-        auto branch2 = parseExpr();
-        return new IfNode(start.sl, cond, branch1, branch2);
-    };
-    parseSequence = [&]() -> SequenceNode* {
-        auto start = consume(isTheToken("{"));
-        std::vector<ExprNode*> exprList;
-        while (tokens.size() && tokens[0].text != "}") {
-            exprList.push_back(parseExpr());
+        int c = _compareMagnitude(a.limbs, b.limbs);
+        return a.negative ? -c : c;
+    }
+    friend BigInt operator+(const BigInt &a, const BigInt &b) {
+        if (a.negative == b.negative) {
+            return BigInt(a.negative, _addMagnitude(a.limbs, b.limbs));
+        } else if (_compareMagnitude(a.limbs, b.limbs) >= 0) {
+            return BigInt(a.negative, _subtractMagnitude(a.limbs, b.limbs));
+        } else {
+            return BigInt(b.negative, _subtractMagnitude(b.limbs, a.limbs));
+        }
+    }
+    friend BigInt operator-(const BigInt &a, const BigInt &b) {
+        return a + BigInt(!b.negative, b.limbs);
+    }
+    friend BigInt operator*(const BigInt &a, const BigInt &b) {
+        return BigInt(a.negative != b.negative, _multiplyMagnitude(a.limbs, b.limbs));
+    }
+    // truncated division (as in C++); the caller must check for zero divisors
+    friend BigInt operator/(const BigInt &a, const BigInt &b) {
+        return BigInt(a.negative != b.negative, _divideMagnitude(a.limbs, b.limbs).first);
+    }
+    friend BigInt operator%(const BigInt &a, const BigInt &b) {
+        return BigInt(a.negative, _divideMagnitude(a.limbs, b.limbs).second);
+    }
+private:
+    using Limbs = std::vector<std::uint32_t>;
+    using LimbSpan = std::span<const std::uint32_t>;
+
+    // operands with fewer limbs are multiplied by the schoolbook algorithm
+    static constexpr std::size_t KARATSUBA_THRESHOLD = 32;
+    // numbers with fewer limbs are converted from and to decimal 9 digits at a time
+    static constexpr std::size_t CONVERSION_THRESHOLD = 32;
+
+    BigInt(bool neg, Limbs l): negative(neg), limbs(std::move(l)) {
+        _trim(limbs);
+        if (limbs.empty()) {
+            negative = false;
         }
-        if (!exprList.size()) {
-            panic("parser", "zero-length sequence", start.sl);
+    }
+
+    static void _trim(Limbs &a) {
+        while (!a.empty() && a.back() == 0) {
+            a.pop_back();
         }
-        consume(isTheToken("}"));
-        return new SequenceNode(start.sl, std::move(exprList));
-    };
-    parseIntrinsicCall = [&]() -> IntrinsicCallNode* {
-        auto start = consume(isTheToken("("));
-        auto intrinsic = consume(isIntrinsicToken);
-        std::vector<ExprNode*> argList;
-        while (tokens.size() && tokens[0].text != ")") {
-            argList.push_back(parseExpr());
-        }
-        consume(isTheToken(")"));
-        return new IntrinsicCallNode(start.sl, std::move(intrinsic.text), std::move(argList));
-    };
-    parseExprCall = [&]() -> ExprCallNode* {
-        auto start = consume(isTheToken("("));
-        auto expr = parseExpr();
-        std::vector<ExprNode*> argList;
-        while (tokens.size() && tokens[0].text != ")") {
-            argList.push_back(parseExpr());
-        }
-        consume(isTheToken(")"));
-        return new ExprCallNode(start.sl, expr, std::move(argList));
-    };
-    parseAt = [&]() -> AtNode* {
-        auto start = consume(isTheToken("@"));
-        auto var = parseVariable();
-        auto expr = parseExpr();
-        return new AtNode(start.sl, var, expr);
-    };
-    parseExpr = [&]() -> ExprNode* {
-        if (!tokens.size()) {
-            panic("parser", "incomplete token stream");
-            return nullptr;
-        } else if (isIntegerToken(tokens[0])) {
-            return parseInteger();
-        } else if (isStringToken(tokens[0])) {
-            return parseString();
-        } else if (tokens[0].text == "lambda") {
-            return parseLambda();
-        } else if (tokens[0].text == "letrec") {
-            return parseLetrec();
-        } else if (tokens[0].text == "if") {
-            return parseIf();
-        // check keywords before var to avoid recognizing keywords as vars
-        } else if (isVariableToken(tokens[0])) {
-            return parseVariable();
-        } else if (tokens[0].text == "{") {
-            return parseSequence();
-        } else if (tokens[0].text == "(") {
-            if (tokens.size() < 2) {
-                panic("parser", "incomplete token stream");
-                return nullptr;
+    }
+    static LimbSpan _trimmed(LimbSpan a) {
+        while (!a.empty() && a.back() == 0) {
+            a = a.first(a.size() - 1);
+        }
+        return a;
+    }
+    static int _compareMagnitude(LimbSpan a, LimbSpan b) {
+        a = _trimmed(a);
+        b = _trimmed(b);
+        if (a.size() != b.size()) {
+            return a.size() < b.size() ? -1 : 1;
+        }
+        for (std::size_t i = a.size(); i-- > 0;) {
+            if (a[i] != b[i]) {
+                return a[i] < b[i] ? -1 : 1;
             }
-            if (isIntrinsicToken(tokens[1])) {
-                return parseIntrinsicCall();
-            } else {
-                return parseExprCall();
+        }
+        return 0;
+    }
+    static Limbs _addMagnitude(LimbSpan a, LimbSpan b) {
+        if (a.size() < b.size()) {
+            std::swap(a, b);
+        }
+        Limbs r(a.size() + 1);
+        std::uint64_t carry = 0;
+        for (std::size_t i = 0; i < a.size(); i++) {
+            carry += static_cast<std::uint64_t>(a[i]) + (i < b.size() ? b[i] : 0);
+            r[i] = static_cast<std::uint32_t>(carry);
+            carry >>= 32;
+        }
+        r[a.size()] = static_cast<std::uint32_t>(carry);
+        _trim(r);
+        return r;
+    }
+    // requires a >= b
+    static Limbs _subtractMagnitude(LimbSpan a, LimbSpan b) {
+        b = _trimmed(b);
+        Limbs r(a.size());
+        std::int64_t borrow = 0;
+        for (std::size_t i = 0; i < a.size(); i++) {
+            std::int64_t d = static_cast<std::int64_t>(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+            borrow = d < 0 ? 1 : 0;
+            r[i] = static_cast<std::uint32_t>(d + (borrow << 32));
+        }
+        _trim(r);
+        return r;
+    }
+    // r += a * base^shift (r must be long enough to hold the sum)
+    static void _addShifted(Limbs &r, LimbSpan a, std::size_t shift) {
+        std::uint64_t carry = 0;
+        std::size_t i = 0;
+        for (; i < a.size(); i++) {
+            carry += static_cast<std::uint64_t>(r[shift + i]) + a[i];
+            r[shift + i] = static_cast<std::uint32_t>(carry);
+            carry >>= 32;
+        }
+        for (; carry != 0 && shift + i < r.size(); i++) {
+            carry += r[shift + i];
+            r[shift + i] = static_cast<std::uint32_t>(carry);
+            carry >>= 32;
+        }
+    }
+    static Limbs _multiplyMagnitude(LimbSpan a, LimbSpan b) {
+        a = _trimmed(a);
+        b = _trimmed(b);
+        if (a.size() < b.size()) {
+            std::swap(a, b);
+        }
+        if (b.empty()) {
+            return {};
+        }
+        Limbs r(a.size() + b.size());
+        if (b.size() < KARATSUBA_THRESHOLD) {
+            for (std::size_t i = 0; i < b.size(); i++) {
+                std::uint64_t carry = 0;
+                for (std::size_t j = 0; j < a.size(); j++) {
+                    carry += static_cast<std::uint64_t>(b[i]) * a[j] + r[i + j];
+                    r[i + j] = static_cast<std::uint32_t>(carry);
+                    carry >>= 32;
+                }
+                r[i + a.size()] = static_cast<std::uint32_t>(carry);
+            }
+        } else if (b.size() * 2 <= a.size()) {
+            // unbalanced operands: multiply b by slices of a
+            for (std::size_t i = 0; i < a.size(); i += b.size()) {
+                _addShifted(r, _multiplyMagnitude(a.subspan(i, std::min(b.size(), a.size() - i)), b), i);
             }
-        } else if (tokens[0].text == "@") {
-            return parseAt();
         } else {
-            panic("parser", "unrecognized token", tokens[0].sl);
-            return nullptr;
+            // Karatsuba: (a1 x + a0)(b1 x + b0) = z2 x^2 + z1 x + z0, where z1 = (a1 + a0)(b1 + b0) - z2 - z0
+            std::size_t half = a.size() / 2;
+            auto a0 = a.first(half), a1 = a.subspan(half);
+            auto b0 = b.first(half), b1 = b.subspan(half);
+            auto z0 = _multiplyMagnitude(a0, b0);
+            auto z2 = _multiplyMagnitude(a1, b1);
+            auto z1 = _multiplyMagnitude(_addMagnitude(a0, a1), _addMagnitude(b0, b1));
+            z1 = _subtractMagnitude(_subtractMagnitude(z1, z0), z2);
+            r.resize(r.size() + 1);
+            _addShifted(r, z0, 0);
+            _addShifted(r, z1, half);
+            _addShifted(r, z2, half * 2);
         }
-    };
-
-    auto expr = parseExpr();
-    if (tokens.size()) {
-        panic("parser", "redundant token(s)", tokens[0].sl);
+        _trim(r);
+        return r;
+    }
+    // a = a * m + add
+    static void _multiplyAddSmall(Limbs &a, std::uint32_t m, std::uint32_t add) {
+        std::uint64_t carry = add;
+        for (auto &limb : a) {
+            carry += static_cast<std::uint64_t>(limb) * m;
+            limb = static_cast<std::uint32_t>(carry);
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            a.push_back(static_cast<std::uint32_t>(carry));
+        }
+    }
+    // a = a / d, returning the remainder
+    static std::uint32_t _divideSmall(Limbs &a, std::uint32_t d) {
+        std::uint64_t rem = 0;
+        for (std::size_t i = a.size(); i-- > 0;) {
+            std::uint64_t cur = (rem << 32) | a[i];
+            a[i] = static_cast<std::uint32_t>(cur / d);
+            rem = cur % d;
+        }
+        _trim(a);
+        return static_cast<std::uint32_t>(rem);
+    }
+    // powers[i] = 10^(9 * 2^i), i.e. 2^i chunks of 9 digits (computed once by repeated squaring)
+    static const Limbs &_powerOfTen(std::size_t i) {
+        thread_local std::vector<Limbs> powers{Limbs{1000000000}};
+        while (powers.size() <= i) {
+            powers.push_back(_multiplyMagnitude(powers.back(), powers.back()));
+        }
+        return powers[i];
+    }
+    // small numbers 9 digits at a time; large ones are split into a high and a low half of 9 * 2^i digits,
+    // which are converted recursively and combined by one (Karatsuba) multiplication
+    static Limbs _parseMagnitude(std::string_view digits) {
+        if (digits.size() <= CONVERSION_THRESHOLD * 9) {
+            static constexpr std::uint32_t POWERS[] = {
+                1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+            };
+            Limbs limbs;
+            std::size_t head = digits.size() % 9 == 0 ? 9 : digits.size() % 9;
+            for (std::size_t i = 0; i < digits.size(); i += (i == 0 ? head : 9)) {
+                std::size_t len = (i == 0 ? head : 9);
+                std::uint32_t chunk = 0;
+                for (std::size_t j = i; j < i + len; j++) {
+                    chunk = chunk * 10 + (digits[j] - '0');
+                }
+                _multiplyAddSmall(limbs, POWERS[len], chunk);
+            }
+            return limbs;
+        }
+        std::size_t i = 0;
+        while (std::size_t(9) << (i + 1) < digits.size()) {
+            i++;
+        }
+        std::size_t low = std::size_t(9) << i;
+        auto r = _multiplyMagnitude(_parseMagnitude(digits.substr(0, digits.size() - low)), _powerOfTen(i));
+        auto l = _parseMagnitude(digits.substr(digits.size() - low));
+        r.resize(std::max(r.size(), l.size()) + 1);
+        _addShifted(r, l, 0);
+        _trim(r);
+        return r;
+    }
+    // appends the digits of a, left-padded with zeros to width digits (no padding when width is 0);
+    // large numbers are split by one (Knuth) division by the power of ten with about half their limbs
+    static void _formatMagnitude(Limbs a, std::size_t width, std::string &out) {
+        if (a.size() <= CONVERSION_THRESHOLD) {
+            // 9 digits at a time, from the lowest
+            std::vector<std::uint32_t> chunks;
+            while (!a.empty()) {
+                chunks.push_back(_divideSmall(a, 1000000000));
+            }
+            std::string s;
+            for (std::size_t k = chunks.size(); k-- > 0;) {
+                auto chunk = std::to_string(chunks[k]);
+                if (!s.empty()) {
+                    s.append(9 - chunk.size(), '0');
+                }
+                s += chunk;
+            }
+            if (s.size() < width) {
+                out.append(width - s.size(), '0');
+            }
+            out += s;
+            return;
+        }
+        std::size_t i = 0;
+        while (_powerOfTen(i + 1).size() * 2 <= a.size() + 1) {
+            i++;
+        }
+        std::size_t low = std::size_t(9) << i;
+        auto [q, r] = _divideMagnitude(a, _powerOfTen(i));
+        _formatMagnitude(std::move(q), width > low ? width - low : 0, out);
+        _formatMagnitude(std::move(r), low, out);
+    }
+    // Knuth's algorithm D (TAOCP 4.3.1); v must be non-zero
+    static std::pair<Limbs, Limbs> _divideMagnitude(const Limbs &u, const Limbs &v) {
+        if (_compareMagnitude(u, v) < 0) {
+            return {Limbs(), u};
+        }
+        if (v.size() == 1) {
+            Limbs q = u;
+            auto r = _divideSmall(q, v[0]);
+            return {std::move(q), Limbs{r}};
+        }
+        constexpr std::uint64_t BASE = std::uint64_t(1) << 32;
+        std::size_t n = v.size(), m = u.size() - v.size();
+        // normalize so that the top bit of the divisor is set
+        int s = std::countl_zero(v.back());
+        auto shiftLeft = [s](std::uint32_t hi, std::uint32_t lo) {
+            return static_cast<std::uint32_t>(
+                (static_cast<std::uint64_t>(hi) << s) | (s == 0 ? 0 : static_cast<std::uint64_t>(lo) >> (32 - s))
+            );
+        };
+        Limbs vn(n), un(u.size() + 1);
+        for (std::size_t i = n - 1; i > 0; i--) {
+            vn[i] = shiftLeft(v[i], v[i - 1]);
+        }
+        vn[0] = shiftLeft(v[0], 0);
+        un[u.size()] = shiftLeft(0, u.back());
+        for (std::size_t i = u.size() - 1; i > 0; i--) {
+            un[i] = shiftLeft(u[i], u[i - 1]);
+        }
+        un[0] = shiftLeft(u[0], 0);
+        Limbs q(m + 1);
+        for (std::size_t j = m + 1; j-- > 0;) {
+            // estimate the quotient digit
+            std::uint64_t num = (static_cast<std::uint64_t>(un[j + n]) << 32) | un[j + n - 1];
+            std::uint64_t qhat = num / vn[n - 1];
+            std::uint64_t rhat = num % vn[n - 1];
+            while (qhat >= BASE || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+                qhat--;
+                rhat += vn[n - 1];
+                if (rhat >= BASE) {
+                    break;
+                }
+            }
+            // multiply and subtract
+            std::int64_t k = 0, t = 0;
+            for (std::size_t i = 0; i < n; i++) {
+                std::uint64_t p = qhat * vn[i];
+                t = static_cast<std::int64_t>(un[i + j]) - k - static_cast<std::int64_t>(p & 0xffffffffu);
+                un[i + j] = static_cast<std::uint32_t>(t);
+                k = static_cast<std::int64_t>(p >> 32) - (t >> 32);
+            }
+            t = static_cast<std::int64_t>(un[j + n]) - k;
+            un[j + n] = static_cast<std::uint32_t>(t);
+            q[j] = static_cast<std::uint32_t>(qhat);
+            // add back if the estimate was one too large
+            if (t < 0) {
+                q[j]--;
+                std::uint64_t carry = 0;
+                for (std::size_t i = 0; i < n; i++) {
+                    carry += static_cast<std::uint64_t>(un[i + j]) + vn[i];
+                    un[i + j] = static_cast<std::uint32_t>(carry);
+                    carry >>= 32;
+                }
+                un[j + n] += static_cast<std::uint32_t>(carry);
+            }
+        }
+        // unnormalize the remainder
+        Limbs r(n);
+        for (std::size_t i = 0; i < n; i++) {
+            r[i] = static_cast<std::uint32_t>(
+                (static_cast<std::uint64_t>(un[i]) >> s) | ((static_cast<std::uint64_t>(un[i + 1]) << (32 - s)))
+            );
+        }
+        _trim(q);
+        _trim(r);
+        return {std::move(q), std::move(r)};
     }
-    return expr;
-}
 
-// ------------------------------
-// runtime
-// ------------------------------
+    bool negative = false;
+    Limbs limbs;
+};
 
-struct Void {
-    Void() = default;
+// for string literals, this class contains the unquoted ones;
+// a string is either an (offset, length) slice of a shared buffer,
+// or a concatenation of two strings (rope node) which is flattened into a new buffer on first access;
+// buffers are append-only, so appending to a slice that ends at its buffer's end doesn't affect other slices
+class String {
+public:
+    String(std::string v): buffer(std::make_shared<std::string>(std::move(v))), length(buffer->size()) {}
+    // a prefix of an existing buffer (without copying)
+    String(std::shared_ptr<std::string> b, std::size_t l): buffer(std::move(b)), length(l) {}
+    // a copy is a new string (not interned, see Value for copies of heaps); the cached hash stays valid
+    String(const String &other):
+        buffer(other.buffer), offset(other.offset), length(other.length),
+        left(other.left), right(other.right), depth(other.depth),
+        hashValue(other.hashValue), hashed(other.hashed) {}
+    String &operator=(const String &) = delete;
 
-    std::string toString() const {
-        return "<void>";
+    // O(1) for flat strings (ropes are flattened first)
+    static String slice(const String &s, std::size_t offset, std::size_t length) {
+        s._flatten();
+        String r = s;
+        r.offset += offset;
+        r.length = length;
+        r.hashed = false;
+        return r;
+    }
+    // amortized O(|s2|) when s1 ends its buffer (accumulation), otherwise O(1) by a rope node
+    static String concat(const String &s1, const String &s2) {
+        if (s1.length == 0) {
+            return s2;
+        } else if (s2.length == 0) {
+            return s1;
+        } else if (s1.length + s2.length <= FLAT_LIMIT) {
+            std::string v;
+            v.reserve(s1.length + s2.length);
+            s1.forEachPiece([&v](std::string_view piece) { v += piece; });
+            s2.forEachPiece([&v](std::string_view piece) { v += piece; });
+            return String(std::move(v));
+        } else if (!s1.left && s1.offset + s1.length == s1.buffer->size()) {
+            s2.appendTo(*s1.buffer);
+            String r = s1;
+            r.length += s2.length;
+            r.hashed = false;
+            return r;
+        } else {
+            String r(std::make_shared<String>(s1), std::make_shared<String>(s2));
+            if (r.depth > MAX_DEPTH) {
+                r._flatten();
+            }
+            return r;
+        }
     }
-};
-
-struct Integer {
-    Integer(int v): value(v) {}
 
+    std::size_t size() const {
+        return length;
+    }
+    // computed on first use and cached
+    std::size_t hash() const {
+        if (!hashed) {
+            hashValue = std::hash<std::string_view>()(view());
+            hashed = true;
+        }
+        return hashValue;
+    }
+    std::string_view view() const {
+        _flatten();
+        return std::string_view(*buffer).substr(offset, length);
+    }
+    // visits the contents piece by piece without flattening
+    template <typename Callback>
+    void forEachPiece(Callback &&callback) const {
+        if (left) {
+            left->forEachPiece(callback);
+            right->forEachPiece(callback);
+        } else {
+            callback(std::string_view(*buffer).substr(offset, length));
+        }
+    }
+    // out may be the buffer of this string (pieces are copied first in that case, as appending may reallocate)
+    void appendTo(std::string &out) const {
+        forEachPiece([&out](std::string_view piece) {
+            if (piece.data() >= out.data() && piece.data() < out.data() + out.size()) {
+                out.append(std::string(piece));
+            } else {
+                out.append(piece);
+            }
+        });
+    }
+    // gives a small slice its own buffer so that it doesn't keep a large one alive
+    void compact() {
+        if (!left && length * 2 < buffer->size()) {
+            buffer = std::make_shared<std::string>(buffer->substr(offset, length));
+            offset = 0;
+        }
+    }
     std::string toString() const {
-        return std::to_string(value);
+        return quote(std::string(view()));
     }
 
-    int value = 0;
-};
+    // set for the cell registered in the state's intern table
+    // (two interned strings are equal iff they are in the same cell)
+    bool interned = false;
+private:
+    // concatenations up to this length are copied into a new flat string
+    static constexpr std::size_t FLAT_LIMIT = 64;
+    // deeper ropes are flattened (this also bounds the recursion in forEachPiece and destructors)
+    static constexpr int MAX_DEPTH = 64;
 
-struct String {  // for string literals, this class contains the unquoted ones
-    String(std::string v): value(std::move(v)) {}
+    String(std::shared_ptr<const String> l, std::shared_ptr<const String> r):
+        length(l->length + r->length), left(std::move(l)), right(std::move(r)),
+        depth(std::max(left->depth, right->depth) + 1) {}
 
-    std::string toString() const {
-        return quote(value);
+    void _flatten() const {
+        if (left) {
+            std::string v;
+            v.reserve(length);
+            forEachPiece([&v](std::string_view piece) { v += piece; });
+            buffer = std::make_shared<std::string>(std::move(v));
+            offset = 0;
+            left.reset();
+            right.reset();
+            depth = 0;
+        }
     }
 
-    std::string value;
+    // flat string (null for unflattened rope nodes)
+    mutable std::shared_ptr<std::string> buffer;
+    mutable std::size_t offset = 0;
+    std::size_t length = 0;
+    // rope node
+    mutable std::shared_ptr<const String> left;
+    mutable std::shared_ptr<const String> right;
+    mutable int depth = 0;
+    mutable std::size_t hashValue = 0;
+    mutable bool hashed = false;
 };
 
-// variable environment; newer variables have larger indices
-using Env = std::vector<std::pair<std::string, Location>>;
+// variable environment (indexed by slots); newer variables have larger indices
+using Env = std::vector<Location>;
 
-std::optional<Location> lookup(const std::string &name, const Env &env) {
-    for (auto p = env.rbegin(); p != env.rend(); p++) {
-        if (p->first == name) {
-            return p->second;
+// a builder is an immutable value too: appending to the newest builder of a buffer extends the buffer in place
+// (amortized O(1) per byte), and appending to an older one copies its prefix first;
+// finishing shares the buffer with the resulting String
+class StringBuilder {
+public:
+    StringBuilder(): buffer(std::make_shared<std::string>()) {}
+
+    static StringBuilder append(const StringBuilder &b, const String &s) {
+        StringBuilder r = b;
+        if (r.length != r.buffer->size()) {
+            r.buffer = std::make_shared<std::string>(r.buffer->substr(0, r.length));
+        }
+        s.appendTo(*r.buffer);
+        r.length += s.size();
+        return r;
+    }
+    String finish() const {
+        return String(buffer, length);
+    }
+    // gives an old builder its own buffer so that it doesn't keep a much longer one alive
+    void compact() {
+        if (length * 2 < buffer->size()) {
+            buffer = std::make_shared<std::string>(buffer->substr(0, length));
         }
     }
-    return std::nullopt;
-}
-
-struct Closure {
-    // a closure should copy its environment
-    Closure(Env e, const LambdaNode *f): env(std::move(e)), fun(f) {}
-
     std::string toString() const {
-        return "<closure evaluated at " + fun->sl.toString() + ">";
+        return "<string builder of length " + std::to_string(length) + ">";
     }
-
-    Env env;
-    const LambdaNode *fun;
+private:
+    std::shared_ptr<std::string> buffer;
+    std::size_t length = 0;
 };
 
-using Value = std::variant<Void, Integer, String, Closure>;
+// an immutable sequence of references
+// (copying an Array shares its elements, and clone() copies them, so that arrays of different heaps never share them)
+class Array {
+    struct Storage;
+public:
+    // the copies of the shared elements made by the clones of a heap
+    using Clones = std::unordered_map<const Storage *, std::shared_ptr<Storage>>;
 
-std::string valueToString(const Value &v) {
-    if (std::holds_alternative<Void>(v)) {
-        return std::get<Void>(v).toString();
-    } else if (std::holds_alternative<Integer>(v)) {
-        return std::get<Integer>(v).toString();
-    } else if (std::holds_alternative<String>(v)) {
-        return std::get<String>(v).toString();
-    } else {
-        return std::get<Closure>(v).toString();
-    }
-}
+    Array(std::vector<Location> e): storage(std::make_shared<Storage>(std::move(e))) {}
 
-// stack layer
+    const std::vector<Location> &elements() const {
+        return storage->elements;
+    }
+    // arrays cloned with the same clones share their elements like the originals
+    Array clone(Clones &clones) const {
+        auto &copy = clones[storage.get()];
+        if (!copy) {
+            copy = std::make_shared<Storage>(*storage);
+        }
+        Array r = *this;
+        r.storage = copy;
+        return r;
+    }
+    // visits the element references if they are not yet stamped with this stamp
+    // (the elements are shared among copies of an array, and should be traced or relocated once)
+    template <typename Callback>
+    void forEachReference(std::uint64_t stamp, Callback &&callback) {
+        // (atomic, so that collector threads sharing the elements agree on which of them visits them)
+        if (std::atomic_ref(storage->stamp).exchange(stamp, std::memory_order_relaxed) == stamp) {
+            return;
+        }
+        for (auto &loc : storage->elements) {
+            callback(loc);
+        }
+    }
+    std::string toString() const {
+        return "<array of length " + std::to_string(storage->elements.size()) + ">";
+    }
+private:
+    struct Storage {
+        Storage(std::vector<Location> e): elements(std::move(e)) {}
 
-struct Layer {
-    // a default argument is evaluated each time the function is called without
-    // that argument (not important here)
-    Layer(std::shared_ptr<Env> e, const ExprNode *x, bool f = false):
-        env(std::move(e)), expr(x), frame(f) {}
+        std::vector<Location> elements;
+        std::uint64_t stamp = 0;
+    };
 
-    // one env per frame (closure call layer)
-    std::shared_ptr<Env> env;
-    const ExprNode *expr;
-    // whether this is a frame
-    bool frame;
-    // program counter inside this expr
-    int pc = 0;
-    // temporary local information for evaluation
-    std::vector<Location> local;
+    std::shared_ptr<Storage> storage;
 };
 
-class State {
+// an immutable hash array mapped trie (HAMT) from keys to values (both are references);
+// each level consumes BITS bits of the hash, and entries whose hashes are fully equal share a collision node;
+// insert and remove copy only the path to the changed entry, so the new map shares the rest with the old one
+// (copying a Map shares its nodes as well, and clone() copies them, so that maps of different heaps never share nodes)
+class Map {
+    struct MapNode;
 public:
-    State(std::string source) {
-        // parsing and static analysis (TODO: exceptions?)
-        expr = parse(lex(std::move(source)));
-        std::function<void(ExprNode*)> checkDuplicate = [](ExprNode *e) -> void {
-            if (auto lnode = dynamic_cast<LambdaNode*>(e)) {
-                std::unordered_set<std::string> varNames;
-                for (auto var : lnode->varList) {
-                    if (varNames.contains(var->name)) {
-                        panic("sema", "duplicate parameter names", lnode->sl);
-                    }
-                    varNames.insert(var->name);
-                }
-            } else if (auto lnode = dynamic_cast<LetrecNode*>(e)) {
-                std::unordered_set<std::string> varNames;
-                for (const auto &ve : lnode->varExprList) {
-                    if (varNames.contains(ve.first->name)) {
-                        panic("sema", "duplicate binding names", lnode->sl);
+    // the copies of the shared nodes made by the clones of a heap
+    using Clones = std::unordered_map<const MapNode *, std::shared_ptr<MapNode>>;
+
+    std::size_t size() const {
+        return count;
+    }
+    template <typename Equal>
+    std::optional<Location> find(std::size_t hash, Location key, const Equal &equal) const {
+        const MapNode *node = root.get();
+        for (int shift = 0; node != nullptr; shift += BITS) {
+            if (shift >= HASH_BITS) {
+                for (const auto &slot : node->slots) {
+                    if (equal(slot.key, key)) {
+                        return slot.value;
                     }
-                    varNames.insert(ve.first->name);
                 }
+                return std::nullopt;
             }
-        };
-        expr->traverse(TraversalMode::topDown, checkDuplicate);
-        expr->computeFreeVars();
-        expr->computeTail(false);
-        // pre-allocate integer literals and string literals
-        std::function<void(ExprNode*)> preAllocate = [this](ExprNode *e) -> void {
-            if (auto inode = dynamic_cast<IntegerNode*>(e)) {
-                inode->loc = this->_new<Integer>(std::stoi(inode->val));  // TODO: exceptions
-            } else if (auto snode = dynamic_cast<StringNode*>(e)) {
-                snode->loc = this->_new<String>(unquote(snode->val));
+            auto bit = _bit(hash, shift);
+            if (!(node->bitmap & bit)) {
+                return std::nullopt;
+            }
+            const auto &slot = node->slots[_index(node->bitmap, bit)];
+            if (slot.child) {
+                node = slot.child.get();
+            } else if (slot.hash == hash && equal(slot.key, key)) {
+                return slot.value;
+            } else {
+                return std::nullopt;
             }
-        };
-        expr->traverse(TraversalMode::topDown, preAllocate);
-        numLiterals = heap.size();
-        // the main frame (which cannot be removed by TCO)
-        stack.emplace_back(std::make_shared<Env>(), nullptr, true);
-        // the first expression (using the env of the main frame)
-        stack.emplace_back(stack.back().env, expr);
-    }
-    State(const State &state):
-        expr(state.expr->clone()),
-        stack(state.stack),
-        heap(state.heap),
-        numLiterals(state.numLiterals),
-        resultLoc(state.resultLoc) {
-    }
-    State &operator=(const State &state) {
-        if (this != &state) {
-            delete expr;
-            expr = state.expr->clone();
-            stack = state.stack;
-            heap = state.heap;
-            numLiterals = state.numLiterals;
-            resultLoc = state.resultLoc;
         }
-        return *this;
+        return std::nullopt;
     }
-    State(State &&state):
-        expr(state.expr),
-        stack(std::move(state.stack)),
-        heap(std::move(state.heap)),
-        numLiterals(state.numLiterals),
-        resultLoc(state.resultLoc) {
-        state.expr = nullptr;
-    }
-    State &operator=(State &&state) {
-        if (this != &state) {
-            delete expr;
-            expr = state.expr;
-            state.expr = nullptr;
-            stack = std::move(state.stack);
-            heap = std::move(state.heap);
-            numLiterals = state.numLiterals;
-            resultLoc = state.resultLoc;
+    template <typename Equal>
+    Map insert(std::size_t hash, Location key, Location value, const Equal &equal) const {
+        bool added = false;
+        Map r;
+        r.root = _insert(root.get(), 0, MapSlot{hash, key, value, nullptr}, equal, added);
+        r.count = count + (added ? 1 : 0);
+        return r;
+    }
+    template <typename Equal>
+    Map remove(std::size_t hash, Location key, const Equal &equal) const {
+        if (!root) {
+            return Map();
+        }
+        bool removed = false;
+        Map r;
+        r.root = _remove(root, 0, hash, key, equal, removed);
+        r.count = count - (removed ? 1 : 0);
+        return r;
+    }
+    // visits the entries in hash order
+    template <typename Callback>
+    void forEach(Callback &&callback) const {
+        if (root) {
+            _forEach(*root, callback);
+        }
+    }
+    // visits the key and value references of the nodes not yet stamped with this stamp
+    // (nodes are shared among maps derived from each other, and each node should be traced or relocated once)
+    template <typename Callback>
+    void forEachReference(std::uint64_t stamp, Callback &&callback) {
+        if (root) {
+            _forEachReference(*root, stamp, callback);
         }
-        return *this;
     }
-    ~State() {
-        if (expr != nullptr) {
-            delete expr;
+    // maps cloned with the same clones share their nodes like the originals
+    Map clone(Clones &clones) const {
+        Map r = *this;
+        if (root) {
+            r.root = _clone(root, clones);
         }
+        return r;
     }
+    std::string toString() const {
+        return "<map of size " + std::to_string(count) + ">";
+    }
+private:
+    static constexpr int BITS = 5;
+    static constexpr int HASH_BITS = sizeof(std::size_t) * 8;
 
-    // returns true iff the step is completed without reaching the end of evaluation
-    bool step() {
-        // be careful! this reference may be invalidated after modifying the stack
-        // so always keep stack change as the last operation(s)
-        auto &layer = stack.back();
-        // main frame; end of evaluation
-        if (layer.expr == nullptr) {
-            return false;
+    // either an entry or a sub-node (when child is not null)
+    struct MapSlot {
+        std::size_t hash;
+        Location key;
+        Location value;
+        std::shared_ptr<MapNode> child;
+    };
+    // slots are ordered by their bits in the bitmap (collision nodes don't use the bitmap)
+    struct MapNode {
+        std::uint32_t bitmap = 0;
+        std::vector<MapSlot> slots;
+        std::uint64_t stamp = 0;
+    };
+
+    static std::uint32_t _bit(std::size_t hash, int shift) {
+        return std::uint32_t(1) << ((hash >> shift) & ((1 << BITS) - 1));
+    }
+    static int _index(std::uint32_t bitmap, std::uint32_t bit) {
+        return std::popcount(bitmap & (bit - 1));
+    }
+    static std::shared_ptr<MapNode> _clone(const std::shared_ptr<MapNode> &node, Clones &clones) {
+        auto &copy = clones[node.get()];
+        if (!copy) {
+            copy = std::make_shared<MapNode>(*node);
+            for (auto &slot : copy->slots) {
+                if (slot.child) {
+                    slot.child = _clone(slot.child, clones);
+                }
+            }
         }
-        // evaluations for every case
-        if (auto inode = dynamic_cast<const IntegerNode*>(layer.expr)) {
-            resultLoc = inode->loc;
-            stack.pop_back();
-        } else if (auto snode = dynamic_cast<const StringNode*>(layer.expr)) {
-            resultLoc = snode->loc;
-            stack.pop_back();
-        } else if (auto vnode = dynamic_cast<const VariableNode*>(layer.expr)) {
-            auto varName = vnode->name;
-            auto loc = lookup(varName, *(layer.env));
-            if (!loc.has_value()) {
-                _errorStack();
-                panic("runtime", "undefined variable " + varName, layer.expr->sl);
-            }
-            resultLoc = loc.value();
-            stack.pop_back();
-        } else if (auto lnode = dynamic_cast<const LambdaNode*>(layer.expr)) {
-            // copy the statically used part of the env into the closure
-            Env savedEnv;
-            // copy
-            auto usedVars = lnode->freeVars;
-            for (auto ptr = layer.env->rbegin(); ptr != layer.env->rend(); ptr++) {
-                if (usedVars.empty()) {
-                    break;
+        return copy;
+    }
+    template <typename Equal>
+    static std::shared_ptr<MapNode> _insert(
+        const MapNode *node, int shift, const MapSlot &entry, const Equal &equal, bool &added) {
+        if (shift >= HASH_BITS) {
+            auto r = node ? std::make_shared<MapNode>(*node) : std::make_shared<MapNode>();
+            for (auto &slot : r->slots) {
+                if (equal(slot.key, entry.key)) {
+                    slot.value = entry.value;
+                    return r;
                 }
-                if (usedVars.contains(ptr->first)) {
-                    savedEnv.push_back(*ptr);
-                    usedVars.erase(ptr->first);
-                }
-            }
-            std::reverse(savedEnv.begin(), savedEnv.end());
-            resultLoc = _new<Closure>(savedEnv, lnode);
-            stack.pop_back();
-        } else if (auto lnode = dynamic_cast<const LetrecNode*>(layer.expr)) {
-            // unified argument recording
-            if (layer.pc > 1 && layer.pc <= static_cast<int>(lnode->varExprList.size()) + 1) {
-                auto varName = lnode->varExprList[layer.pc - 2].first->name;
-                auto loc = lookup(
-                    varName,
-                    *(layer.env)
-                );
-                // this shouldn't happen since those variables are newly introduced by letrec
-                if (!loc.has_value()) {
-                    _errorStack();
-                    panic("runtime", "undefined variable " + varName, layer.expr->sl);
-                }
-                // copy (inherited resultLoc)
-                heap[loc.value()] = heap[resultLoc];
-            }
-            // create all new locations
-            if (layer.pc == 0) {
-                layer.pc++;
-                for (const auto &[var, _] : lnode->varExprList) {
-                    layer.env->push_back(std::make_pair(
-                        var->name,
-                        _new<Void>()
-                    ));
-                }
-            // evaluate bindings
-            } else if (layer.pc <= static_cast<int>(lnode->varExprList.size())) {
-                layer.pc++;
-                // note: growing the stack might invalidate the reference "layer"
-                //       but this is fine since next time "layer" will be re-bound
-                stack.emplace_back(
-                    layer.env,
-                    lnode->varExprList[layer.pc - 2].second
-                );
-            // evaluate body
-            } else if (layer.pc == static_cast<int>(lnode->varExprList.size()) + 1) {
-                layer.pc++;
-                stack.emplace_back(
-                    layer.env,
-                    lnode->expr
-                );
-            // finish letrec
+            }
+            r->slots.push_back(entry);
+            added = true;
+            return r;
+        }
+        auto bit = _bit(entry.hash, shift);
+        if (node == nullptr) {
+            auto r = std::make_shared<MapNode>();
+            r->bitmap = bit;
+            r->slots.push_back(entry);
+            added = true;
+            return r;
+        }
+        auto r = std::make_shared<MapNode>(*node);
+        int index = _index(node->bitmap, bit);
+        if (!(node->bitmap & bit)) {
+            r->bitmap |= bit;
+            r->slots.insert(r->slots.begin() + index, entry);
+            added = true;
+            return r;
+        }
+        auto &slot = r->slots[index];
+        if (slot.child) {
+            slot.child = _insert(slot.child.get(), shift + BITS, entry, equal, added);
+        } else if (slot.hash == entry.hash && equal(slot.key, entry.key)) {
+            slot.value = entry.value;
+        } else {
+            // push both entries down one level
+            bool ignored = false;
+            auto child = _insert(nullptr, shift + BITS, slot, equal, ignored);
+            slot = MapSlot{0, Location(), Location(), _insert(child.get(), shift + BITS, entry, equal, added)};
+        }
+        return r;
+    }
+    // returns the same node if the key is absent, and null if the node becomes empty
+    template <typename Equal>
+    static std::shared_ptr<MapNode> _remove(
+        const std::shared_ptr<MapNode> &node, int shift, std::size_t hash, Location key,
+        const Equal &equal, bool &removed) {
+        if (shift >= HASH_BITS) {
+            for (std::size_t i = 0; i < node->slots.size(); i++) {
+                if (equal(node->slots[i].key, key)) {
+                    removed = true;
+                    if (node->slots.size() == 1) {
+                        return nullptr;
+                    }
+                    auto r = std::make_shared<MapNode>(*node);
+                    r->slots.erase(r->slots.begin() + i);
+                    return r;
+                }
+            }
+            return node;
+        }
+        auto bit = _bit(hash, shift);
+        if (!(node->bitmap & bit)) {
+            return node;
+        }
+        int index = _index(node->bitmap, bit);
+        const auto &slot = node->slots[index];
+        std::shared_ptr<MapNode> child;
+        if (slot.child) {
+            child = _remove(slot.child, shift + BITS, hash, key, equal, removed);
+            if (child == slot.child) {
+                return node;
+            }
+        } else if (!(slot.hash == hash && equal(slot.key, key))) {
+            return node;
+        } else {
+            removed = true;
+        }
+        if (!child && node->slots.size() == 1) {
+            return nullptr;
+        }
+        auto r = std::make_shared<MapNode>(*node);
+        if (!child) {
+            r->bitmap &= ~bit;
+            r->slots.erase(r->slots.begin() + index);
+        } else if (child->slots.size() == 1 && !child->slots[0].child) {
+            // a sub-node with a single entry is inlined
+            r->slots[index] = child->slots[0];
+        } else {
+            r->slots[index].child = std::move(child);
+        }
+        return r;
+    }
+    template <typename Callback>
+    static void _forEach(const MapNode &node, Callback &callback) {
+        for (const auto &slot : node.slots) {
+            if (slot.child) {
+                _forEach(*slot.child, callback);
             } else {
-                int nParams = lnode->varExprList.size();
-                for (int i = 0; i < nParams; i++) {
-                    layer.env->pop_back();
+                callback(slot.key, slot.value);
+            }
+        }
+    }
+    template <typename Callback>
+    static void _forEachReference(MapNode &node, std::uint64_t stamp, Callback &callback) {
+        // (atomic, so that collector threads sharing a node agree on which of them visits it)
+        if (std::atomic_ref(node.stamp).exchange(stamp, std::memory_order_relaxed) == stamp) {
+            return;
+        }
+        for (auto &slot : node.slots) {
+            if (slot.child) {
+                _forEachReference(*slot.child, stamp, callback);
+            } else {
+                callback(slot.key);
+                callback(slot.value);
+            }
+        }
+    }
+
+    std::shared_ptr<MapNode> root;
+    std::size_t count = 0;
+};
+
+struct Closure {
+    // a closure should copy its environment
+    Closure(Env e, const Node *f): env(std::move(e)), fun(f) {}
+
+    std::string toString() const {
+        return "<closure evaluated at " + fun->sl.toString() + ">";
+    }
+
+    Env env;
+    // the lambda node
+    const Node *fun;
+};
+
+// a tagged 64-bit word: the low 3 bits are the type tag;
+// Void and Integer payloads are inline, and the other payloads are owned out-of-line objects
+// (copying a Value copies its payload, so the value semantics are those of std::variant,
+// except that copies of an Array or a Map share its immutable contents (a Heap copy clones them);
+// a copied String stays interned, as copies of Values are copies of heap cells, e.g. when a State is copied)
+class Value {
+public:
+    template <typename T>
+    static constexpr bool isType =
+        std::same_as<T, Void> || std::same_as<T, Integer> || std::same_as<T, String> || std::same_as<T, Closure> ||
+        std::same_as<T, StringBuilder> || std::same_as<T, Array> || std::same_as<T, Map> || std::same_as<T, BigInt>;
+
+    Value(): bits(VOID_TAG) {}
+    Value(Void): bits(VOID_TAG) {}
+    Value(Integer i): bits((static_cast<std::uint64_t>(i.value) << 3) | INTEGER_TAG) {}
+    Value(String s): bits(_box(new String(std::move(s)), STRING_TAG)) {}
+    Value(Closure c): bits(_box(new Closure(std::move(c)), CLOSURE_TAG)) {}
+    Value(StringBuilder b): bits(_box(new StringBuilder(std::move(b)), BUILDER_TAG)) {}
+    Value(Array a): bits(_box(new Array(std::move(a)), ARRAY_TAG)) {}
+    Value(Map m): bits(_box(new Map(std::move(m)), MAP_TAG)) {}
+    Value(BigInt b): bits(_box(new BigInt(std::move(b)), BIGINT_TAG)) {}
+    Value(const Value &other): bits(other.bits) {
+        _copyPayload();
+    }
+    Value(Value &&other) noexcept: bits(other.bits) {
+        other.bits = VOID_TAG;
+    }
+    Value &operator=(const Value &other) {
+        if (this != &other) {
+            _release();
+            bits = other.bits;
+            _copyPayload();
+        }
+        return *this;
+    }
+    Value &operator=(Value &&other) noexcept {
+        if (this != &other) {
+            _release();
+            bits = other.bits;
+            other.bits = VOID_TAG;
+        }
+        return *this;
+    }
+    ~Value() {
+        _release();
+    }
+
+    template <typename T>
+    requires isType<T>
+    bool is() const {
+        return (bits & TAG_MASK) == _tag<T>();
+    }
+    // the caller must check the type first
+    Integer getInteger() const {
+        return Integer(static_cast<std::int64_t>(bits) >> 3);
+    }
+    String &getString() const {
+        return *_unbox<String>();
+    }
+    Closure &getClosure() const {
+        return *_unbox<Closure>();
+    }
+    StringBuilder &getStringBuilder() const {
+        return *_unbox<StringBuilder>();
+    }
+    Array &getArray() const {
+        return *_unbox<Array>();
+    }
+    Map &getMap() const {
+        return *_unbox<Map>();
+    }
+    BigInt &getBigInt() const {
+        return *_unbox<BigInt>();
+    }
+    std::string toString() const {
+        switch (bits & TAG_MASK) {
+            case VOID_TAG:
+                return Void().toString();
+            case INTEGER_TAG:
+                return getInteger().toString();
+            case STRING_TAG:
+                return getString().toString();
+            case CLOSURE_TAG:
+                return getClosure().toString();
+            case BUILDER_TAG:
+                return getStringBuilder().toString();
+            case ARRAY_TAG:
+                return getArray().toString();
+            case MAP_TAG:
+                return getMap().toString();
+            default:
+                return getBigInt().toString();
+        }
+    }
+private:
+    static constexpr std::uint64_t TAG_MASK = 0b111;
+    static constexpr std::uint64_t VOID_TAG = 0;
+    static constexpr std::uint64_t INTEGER_TAG = 1;
+    static constexpr std::uint64_t STRING_TAG = 2;
+    static constexpr std::uint64_t CLOSURE_TAG = 3;
+    static constexpr std::uint64_t BUILDER_TAG = 4;
+    static constexpr std::uint64_t ARRAY_TAG = 5;
+    static constexpr std::uint64_t MAP_TAG = 6;
+    static constexpr std::uint64_t BIGINT_TAG = 7;
+
+    template <typename T>
+    static constexpr std::uint64_t _tag() {
+        if constexpr (std::same_as<T, Void>) {
+            return VOID_TAG;
+        } else if constexpr (std::same_as<T, Integer>) {
+            return INTEGER_TAG;
+        } else if constexpr (std::same_as<T, String>) {
+            return STRING_TAG;
+        } else if constexpr (std::same_as<T, Closure>) {
+            return CLOSURE_TAG;
+        } else if constexpr (std::same_as<T, StringBuilder>) {
+            return BUILDER_TAG;
+        } else if constexpr (std::same_as<T, Array>) {
+            return ARRAY_TAG;
+        } else if constexpr (std::same_as<T, Map>) {
+            return MAP_TAG;
+        } else {
+            return BIGINT_TAG;
+        }
+    }
+    template <typename T>
+    static std::uint64_t _box(T *p, std::uint64_t tag) {
+        static_assert(alignof(T) > TAG_MASK);
+        return reinterpret_cast<std::uintptr_t>(p) | tag;
+    }
+    template <typename T>
+    T *_unbox() const {
+        return reinterpret_cast<T*>(static_cast<std::uintptr_t>(bits & ~TAG_MASK));
+    }
+    void _copyPayload() {
+        if (is<String>()) {
+            auto s = new String(getString());
+            s->interned = getString().interned;
+            bits = _box(s, STRING_TAG);
+        } else if (is<Closure>()) {
+            bits = _box(new Closure(getClosure()), CLOSURE_TAG);
+        } else if (is<StringBuilder>()) {
+            bits = _box(new StringBuilder(getStringBuilder()), BUILDER_TAG);
+        } else if (is<Array>()) {
+            bits = _box(new Array(getArray()), ARRAY_TAG);
+        } else if (is<Map>()) {
+            bits = _box(new Map(getMap()), MAP_TAG);
+        } else if (is<BigInt>()) {
+            bits = _box(new BigInt(getBigInt()), BIGINT_TAG);
+        }
+    }
+    void _release() {
+        if (is<String>()) {
+            delete _unbox<String>();
+        } else if (is<Closure>()) {
+            delete _unbox<Closure>();
+        } else if (is<StringBuilder>()) {
+            delete _unbox<StringBuilder>();
+        } else if (is<Array>()) {
+            delete _unbox<Array>();
+        } else if (is<Map>()) {
+            delete _unbox<Map>();
+        } else if (is<BigInt>()) {
+            delete _unbox<BigInt>();
+        }
+    }
+
+    std::uint64_t bits;
+};
+
+static_assert(sizeof(Value) == 8);
+
+std::string valueToString(const Value &v) {
+    return v.toString();
+}
+
+// the cells of a State; the Values of a heap share the contents of arrays and maps,
+// so a copy of a heap clones those contents (once per shared object, so that the copy shares them in the same way)
+class Heap : public std::vector<Value> {
+public:
+    Heap() = default;
+    Heap(const Heap &other): std::vector<Value>(other) {
+        _unshare();
+    }
+    Heap &operator=(const Heap &other) {
+        std::vector<Value>::operator=(other);
+        _unshare();
+        return *this;
+    }
+    Heap(Heap &&) = default;
+    Heap &operator=(Heap &&) = default;
+private:
+    void _unshare() {
+        Array::Clones arrays;
+        Map::Clones maps;
+        for (auto &v : *this) {
+            if (v.is<Array>()) {
+                v = v.getArray().clone(arrays);
+            } else if (v.is<Map>()) {
+                v = v.getMap().clone(maps);
+            }
+        }
+    }
+};
+
+// stack layer
+
+struct Layer {
+    // a default argument is evaluated each time the function is called without
+    // that argument (not important here)
+    Layer(std::shared_ptr<Env> e, NodeId x, bool f = false, const Chunk *c = nullptr):
+        env(std::move(e)), expr(x), frame(f), chunk(c) {}
+
+    // one env per frame (closure call layer)
+    std::shared_ptr<Env> env;
+    // -1 for the main frame
+    NodeId expr;
+    // whether this is a frame
+    bool frame;
+    // the code being executed (bytecode engine only)
+    const Chunk *chunk;
+    // program counter inside this expr (or chunk)
+    int pc = 0;
+    // temporary local information for evaluation
+    std::vector<Location> local;
+};
+
+enum class Engine {
+    ast,
+    bytecode
+};
+
+// threads that run jobs of the parallel collector together (the calling thread takes part as thread 0);
+// they are started on first use and kept until the pool is destroyed or the number of threads changes,
+// and a copy of a pool doesn't share the threads (it starts its own)
+class WorkerPool {
+public:
+    WorkerPool() = default;
+    WorkerPool(const WorkerPool &) {}
+    WorkerPool &operator=(const WorkerPool &) {
+        return *this;
+    }
+    ~WorkerPool() {
+        _stop();
+    }
+
+    // runs job(t) for each thread t in [0, threads) and waits for all of them
+    void run(int threads, const std::function<void(int)> &job) {
+        if (static_cast<int>(workers.size()) != threads - 1) {
+            _stop();
+            _start(threads - 1);
+        }
+        {
+            std::lock_guard lock(mutex);
+            current = &job;
+            pending = threads - 1;
+            generation++;
+        }
+        wake.notify_all();
+        job(0);
+        std::unique_lock lock(mutex);
+        finished.wait(lock, [this] { return pending == 0; });
+    }
+private:
+    void _start(int n) {
+        stopping = false;
+        for (int t = 1; t <= n; t++) {
+            workers.emplace_back([this, t, seen = generation] { _work(t, seen); });
+        }
+    }
+    void _stop() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        // (joins the threads)
+        workers.clear();
+    }
+    void _work(int t, std::uint64_t seen) {
+        std::unique_lock lock(mutex);
+        while (true) {
+            wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            lock.unlock();
+            (*current)(t);
+            lock.lock();
+            if (--pending == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(int)> *current = nullptr;
+    std::uint64_t generation = 0;
+    int pending = 0;
+    bool stopping = false;
+    std::vector<std::jthread> workers;
+};
+
+// garbage collection marks: one bit per heap cell in [first, end)
+class MarkBitmap {
+public:
+    void reset(int begin, int end) {
+        first = begin;
+        words.assign((end - begin + 63) / 64, 0);
+    }
+    bool contains(int index) const {
+        int offset = index - first;
+        return (words[offset / 64] >> (offset % 64)) & 1;
+    }
+    // returns whether the bit was not set before
+    bool insert(int index) {
+        int offset = index - first;
+        auto bit = std::uint64_t(1) << (offset % 64);
+        auto &word = words[offset / 64];
+        bool inserted = !(word & bit);
+        word |= bit;
+        return inserted;
+    }
+    // insert() for concurrent markers
+    bool insertAtomic(int index) {
+        int offset = index - first;
+        auto bit = std::uint64_t(1) << (offset % 64);
+        std::atomic_ref word(words[offset / 64]);
+        return !(word.load(std::memory_order_relaxed) & bit) && !(word.fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+    // numbers the marked cells in order (a prefix sum of the word populations)
+    void computeForwarding() {
+        prepareForwarding();
+        number(0, wordCount(), 0);
+    }
+    // computeForwarding() in pieces (e.g. in parallel): number() each range of words
+    // with the rank of its first word, i.e. the population of the words before it
+    void prepareForwarding() {
+        ranks.resize(words.size());
+    }
+    int population(int begin, int end) const {
+        int count = 0;
+        for (int k = begin; k < end; k++) {
+            count += std::popcount(words[k]);
+        }
+        return count;
+    }
+    void number(int begin, int end, int rank) {
+        for (int k = begin; k < end; k++) {
+            ranks[k] = rank;
+            rank += std::popcount(words[k]);
+        }
+    }
+    // the index of a marked cell after the marked cells are slid down to first (cells below first stay)
+    int forward(int index) const {
+        int offset = index - first;
+        if (offset < 0) {
+            return index;
+        }
+        auto below = words[offset / 64] & ((std::uint64_t(1) << (offset % 64)) - 1);
+        return first + ranks[offset / 64] + std::popcount(below);
+    }
+    // the bits of the cells [first + 64 * k, first + 64 * k + 64)
+    std::uint64_t word(int k) const {
+        return k < static_cast<int>(words.size()) ? words[k] : 0;
+    }
+    int begin() const {
+        return first;
+    }
+    int wordCount() const {
+        return words.size();
+    }
+private:
+    int first = 0;
+    std::vector<std::uint64_t> words;
+    // the number of marked cells before each word (computeForwarding)
+    std::vector<int> ranks;
+};
+
+class State {
+public:
+    State(std::string source, Engine e = Engine::ast): engine(e) {
+        // parsing and static analysis (TODO: exceptions?)
+        program = std::make_shared<Program>();
+        auto &ast = program->ast;
+        Parser(source, program->symbols, ast).parse();
+        checkDuplicates(ast);
+        for (auto &node : ast.nodes) {
+            if (node.kind == NodeKind::intrinsicCallNode) {
+                auto id = _resolveIntrinsic(program->symbols.name(node.c));
+                if (!id.has_value()) {
+                    panic("sema", "unrecognized intrinsic call", node.sl);
+                }
+                if (node.b != intrinsics[id.value()].arity) {
+                    panic("sema", "wrong number of arguments on intrinsic call", node.sl);
                 }
-                // this layer cannot be optimized by TCO because we need nParams to revert env
-                // no need to update resultLoc: inherited from body evaluation
+                node.d = id.value();
+            }
+        }
+        computeTail(ast);
+        SlotResolver(ast, program->symbols.size(), computeFreeVars(ast)).resolve(ast.root());
+        // the canonical Void (shared by every Void result except letrec placeholders, which are patched in place)
+        heap.emplace_back(Void());
+        resultLoc = VOID_LOCATION;
+        // the one-character strings (interned, so equal runtime strings resolve to them as well)
+        for (int c = 0; c < 256; c++) {
+            _intern(String(std::string(1, static_cast<char>(c))));
+        }
+        // pre-allocate integer literals and string literals
+        for (auto &node : ast.nodes) {
+            if (node.kind == NodeKind::integerNode) {
+                node.c = _moveNew(_parseInteger(ast.literal(node)).value()).raw();
+            } else if (node.kind == NodeKind::stringNode) {
+                node.c = _intern(String(unquote(std::string(ast.literal(node))))).raw();
+            }
+        }
+        numLiterals = heap.size();
+        nurseryStart = numLiterals;
+        gcThreshold = numLiterals + 64;
+        if (engine == Engine::bytecode) {
+            program->chunks = Compiler().compile(ast);
+        }
+        // the main frame (which cannot be removed by TCO)
+        stack.emplace_back(std::make_shared<Env>(), -1, true);
+        // the first expression (using the env of the main frame)
+        stack.emplace_back(
+            stack.back().env,
+            ast.root(),
+            false,
+            engine == Engine::bytecode ? &(program->chunks[0]) : nullptr
+        );
+    }
+    // copies share the immutable program; everything else is copied
+    State(const State &) = default;
+    State &operator=(const State &) = default;
+    State(State &&) = default;
+    State &operator=(State &&) = default;
+
+    // returns true iff the step is completed without reaching the end of evaluation
+    // (garbage collection is part of the step)
+    bool step() {
+        stats.steps++;
+        bool running = engine == Engine::bytecode ? _bytecodeStep() : _astStep();
+        if (running) {
+            _collectGarbage();
+        }
+        return running;
+    }
+    void execute() {
+        while (step());
+    }
+    // 0 (the default) collects the whole heap at once;
+    // otherwise full collections are incremental, and each step does about this many units of work
+    void setGcBudget(int budget) {
+        gcBudget = budget;
+    }
+    // 1 (the default) collects on the calling thread; more threads are used for large heaps
+    void setGcThreads(int threads) {
+        gcThreads = threads;
+    }
+    Value getResult() const {
+        return _load(resultLoc);
+    }
+    struct Stats {
+        long long steps = 0;
+        long long allocations = 0;
+        long long collections = 0;
+        long long minorCollections = 0;
+        // pauses[i] counts the collections whose longest pause took less than 2^i microseconds
+        // (and at least 2^(i-1) microseconds for i > 0); a minor collection is recorded with the full collection
+        // that may follow it in the same step, and an incremental cycle is recorded once
+        std::array<long long, 32> pauses{};
+        // the longest collection work of a step
+        double maxPause = 0;
+    };
+    const Stats &getStats() const {
+        return stats;
+    }
+private:
+    bool _astStep() {
+        // be careful! this reference may be invalidated after modifying the stack
+        // so always keep stack change as the last operation(s)
+        auto &layer = stack.back();
+        // main frame; end of evaluation
+        if (layer.expr < 0) {
+            return false;
+        }
+        const auto &ast = program->ast;
+        const auto &node = ast.nodes[layer.expr];
+        // evaluations for every case
+        switch (node.kind) {
+            case NodeKind::integerNode:
+            case NodeKind::stringNode:
+                resultLoc = Location::fromRaw(node.c);
+                stack.pop_back();
+                break;
+            case NodeKind::variableNode:
+                resultLoc = _readVariable(node, *(layer.env));
+                stack.pop_back();
+                break;
+            case NodeKind::lambdaNode:
+                resultLoc = _newClosure(node, *(layer.env));
                 stack.pop_back();
+                break;
+            case NodeKind::letrecNode: {
+                auto ids = ast.list(node);
+                int nBindings = node.b / 2;
+                // unified argument recording
+                if (layer.pc > 1 && layer.pc <= nBindings + 1) {
+                    auto loc = (*(layer.env))[ast.nodes[ids[2 * (layer.pc - 2)]].b];
+                    // copy (inherited resultLoc)
+                    _patch(loc, resultLoc);
+                }
+                // create all new locations
+                if (layer.pc == 0) {
+                    layer.pc++;
+                    for (int i = 0; i < nBindings; i++) {
+                        layer.env->push_back(_new<Void>());
+                    }
+                // evaluate bindings
+                } else if (layer.pc <= nBindings) {
+                    layer.pc++;
+                    // note: growing the stack might invalidate the reference "layer"
+                    //       but this is fine since next time "layer" will be re-bound
+                    stack.emplace_back(
+                        layer.env,
+                        ids[2 * (layer.pc - 2) + 1]
+                    );
+                // evaluate body
+                } else if (layer.pc == nBindings + 1) {
+                    layer.pc++;
+                    stack.emplace_back(
+                        layer.env,
+                        node.c
+                    );
+                // finish letrec
+                } else {
+                    layer.env->resize(layer.env->size() - nBindings);
+                    // this layer cannot be optimized by TCO because we need nBindings to revert env
+                    // no need to update resultLoc: inherited from body evaluation
+                    stack.pop_back();
+                }
+                break;
             }
-        } else if (auto inode = dynamic_cast<const IfNode*>(layer.expr)) {
-            // evaluate condition
-            if (layer.pc == 0) {
-                layer.pc++;
-                stack.emplace_back(layer.env, inode->cond);
-            // evaluate one branch
-            } else if (layer.pc == 1) {
-                layer.pc++;
-                // inherited condition value
-                if (!std::holds_alternative<Integer>(heap[resultLoc])) {
-                    _errorStack();
-                    panic("runtime", "wrong cond type", layer.expr->sl);
+            case NodeKind::ifNode: {
+                // evaluate condition
+                if (layer.pc == 0) {
+                    layer.pc++;
+                    stack.emplace_back(layer.env, node.a);
+                // evaluate one branch
+                } else if (layer.pc == 1) {
+                    layer.pc++;
+                    // inherited condition value
+                    if (!_is<Integer>(resultLoc)) {
+                        _errorStack();
+                        panic("runtime", "wrong cond type", node.sl);
+                    }
+                    if (_getInteger(resultLoc)) {
+                        stack.emplace_back(layer.env, node.b);
+                    } else {
+                        stack.emplace_back(layer.env, node.c);
+                    }
+                // finish if
+                } else {
+                    // no need to update resultLoc: inherited
+                    stack.pop_back();
                 }
-                if (std::get<Integer>(heap[resultLoc]).value) {
-                    stack.emplace_back(layer.env, inode->branch1);
+                break;
+            }
+            case NodeKind::sequenceNode: {
+                // evaluate one-by-one
+                if (layer.pc < node.b) {
+                    layer.pc++;
+                    stack.emplace_back(
+                        layer.env,
+                        ast.lists[node.a + layer.pc - 1]
+                    );
+                // finish
                 } else {
-                    stack.emplace_back(layer.env, inode->branch2);
+                    // sequence's value is the last expression's value
+                    // no need to update resultLoc: inherited
+                    stack.pop_back();
                 }
-            // finish if
-            } else {
-                // no need to update resultLoc: inherited
-                stack.pop_back();
+                break;
+            }
+            case NodeKind::intrinsicCallNode: {
+                // unified argument recording
+                if (layer.pc > 0 && layer.pc <= node.b) {
+                    layer.local.push_back(resultLoc);
+                }
+                // evaluate arguments
+                if (layer.pc < node.b) {
+                    layer.pc++;
+                    stack.emplace_back(
+                        layer.env,
+                        ast.lists[node.a + layer.pc - 1]
+                    );
+                // intrinsic call doesn't grow the stack
+                } else {
+                    resultLoc = _callIntrinsic(
+                        node.sl,
+                        node.d,
+                        // intrinsic call is pass by reference
+                        layer.local
+                    );
+                    stack.pop_back();
+                }
+                break;
+            }
+            case NodeKind::exprCallNode: {
+                // unified argument recording
+                if (layer.pc > 2 && layer.pc <= node.b + 2) {
+                    layer.local.push_back(resultLoc);
+                }
+                // evaluate the callee
+                if (layer.pc == 0) {
+                    layer.pc++;
+                    stack.emplace_back(
+                        layer.env,
+                        node.c
+                    );
+                // initialization
+                } else if (layer.pc == 1) {
+                    layer.pc++;
+                    // inherited callee location
+                    layer.local.push_back(resultLoc);
+                // evaluate arguments
+                } else if (layer.pc <= node.b + 1) {
+                    layer.pc++;
+                    stack.emplace_back(
+                        layer.env,
+                        ast.lists[node.a + layer.pc - 3]
+                    );
+                // call
+                } else if (layer.pc == node.b + 2) {
+                    layer.pc++;
+                    auto [fun, newEnv] = _prepareCall(node.sl, layer.local);
+                    // tail call optimization
+                    if (node.tail) {
+                        while (!(stack.back().frame)) {
+                            stack.pop_back();
+                        }
+                        // pop the frame
+                        stack.pop_back();
+                    }
+                    // evaluation of the closure body
+                    stack.emplace_back(
+                        // new frame has new env
+                        std::make_shared<Env>(std::move(newEnv)),
+                        fun->c,
+                        true
+                    );
+                // finish
+                } else {
+                    // no need to update resultLoc: inherited
+                    stack.pop_back();
+                }
+                break;
             }
-        } else if (auto snode = dynamic_cast<const SequenceNode*>(layer.expr)) {
-            // evaluate one-by-one
-            if (layer.pc < static_cast<int>(snode->exprList.size())) {
-                layer.pc++;
+            case NodeKind::atNode: {
+                // evaluate the expr
+                if (layer.pc == 0) {
+                    layer.pc++;
+                    stack.emplace_back(layer.env, node.b);
+                } else {
+                    // inherited resultLoc
+                    resultLoc = _accessMember(node);
+                    stack.pop_back();
+                }
+                break;
+            }
+            default:
+                _errorStack();
+                panic("runtime", "unrecognized AST node", node.sl);
+        }
+        return true;
+    }
+    // executes one instruction
+    bool _bytecodeStep() {
+        // be careful! this reference may be invalidated after modifying the stack
+        // so always keep stack change as the last operation(s)
+        auto &layer = stack.back();
+        // main frame; end of evaluation
+        if (layer.expr < 0) {
+            return false;
+        }
+        const auto &nodes = program->ast.nodes;
+        const auto &ins = layer.chunk->code[layer.pc++];
+        switch (ins.op) {
+            case OpCode::literal:
+                resultLoc = Location::fromRaw(ins.arg);
+                break;
+            case OpCode::variable:
+                resultLoc = _readVariable(nodes[ins.node], *(layer.env));
+                break;
+            case OpCode::lambda:
+                resultLoc = _newClosure(nodes[ins.node], *(layer.env));
+                break;
+            case OpCode::push:
+                layer.local.push_back(resultLoc);
+                break;
+            case OpCode::letrecBegin: {
+                int n = nodes[ins.node].b / 2;
+                for (int i = 0; i < n; i++) {
+                    layer.env->push_back(_new<Void>());
+                }
+                break;
+            }
+            case OpCode::letrecBind:
+                _patch((*(layer.env))[ins.arg], resultLoc);
+                break;
+            case OpCode::letrecEnd: {
+                int n = nodes[ins.node].b / 2;
+                layer.env->resize(layer.env->size() - n);
+                break;
+            }
+            case OpCode::jumpIfFalse:
+                if (!_is<Integer>(resultLoc)) {
+                    _errorStack();
+                    panic("runtime", "wrong cond type", nodes[ins.node].sl);
+                }
+                if (!_getInteger(resultLoc)) {
+                    layer.pc = ins.arg;
+                }
+                break;
+            case OpCode::jump:
+                layer.pc = ins.arg;
+                break;
+            case OpCode::intrinsicCall: {
+                auto args = std::span<const Location>(layer.local).last(ins.arg);
+                resultLoc = _callIntrinsic(
+                    nodes[ins.node].sl,
+                    nodes[ins.node].d,
+                    // intrinsic call is pass by reference
+                    args
+                );
+                layer.local.resize(layer.local.size() - ins.arg);
+                break;
+            }
+            case OpCode::exprCall:
+            case OpCode::tailCall: {
+                auto [fun, newEnv] = _prepareCall(
+                    nodes[ins.node].sl,
+                    std::span<const Location>(layer.local).last(ins.arg + 1)
+                );
+                layer.local.resize(layer.local.size() - ins.arg - 1);
+                // tail call optimization (tail calls only appear in closure bodies,
+                // whose chunks are executed directly in their frames)
+                if (ins.op == OpCode::tailCall) {
+                    stack.pop_back();
+                }
                 stack.emplace_back(
-                    layer.env,
-                    snode->exprList[layer.pc - 1]
+                    std::make_shared<Env>(std::move(newEnv)),
+                    fun->c,
+                    true,
+                    &(program->chunks[program->ast.lambdas[fun->d].chunk])
                 );
-            // finish
-            } else {
-                // sequence's value is the last expression's value
+                break;
+            }
+            case OpCode::at:
+                resultLoc = _accessMember(nodes[ins.node]);
+                break;
+            case OpCode::ret:
                 // no need to update resultLoc: inherited
                 stack.pop_back();
+                break;
+        }
+        return true;
+    }
+    // helpers shared by both engines
+    Location _readVariable(const Node &vnode, const Env &env) {
+        if (vnode.b < 0) {
+            _errorStack();
+            panic("runtime", "undefined variable " + program->symbols.name(vnode.a), vnode.sl);
+        }
+        return env[vnode.b];
+    }
+    Location _newClosure(const Node &lnode, const Env &env) {
+        // copy the statically used part of the env into the closure
+        auto captures = program->ast.captureList(program->ast.lambdas[lnode.d]);
+        Env savedEnv;
+        savedEnv.reserve(captures.size());
+        for (const auto &capture : captures) {
+            savedEnv.push_back(env[capture.slot]);
+        }
+        return _new<Closure>(std::move(savedEnv), &lnode);
+    }
+    // callAndArgs = callee location followed by argument locations
+    std::pair<const Node*, Env> _prepareCall(
+        SourceLocation sl, std::span<const Location> callAndArgs
+    ) {
+        auto exprLoc = callAndArgs[0];
+        if (!_is<Closure>(exprLoc)) {
+            _errorStack();
+            panic("runtime", "calling a non-callable", sl);
+        }
+        auto &closure = heap[exprLoc.index()].getClosure();
+        // types will be checked inside the closure call
+        if (static_cast<int>(callAndArgs.size()) - 1 != closure.fun->b) {
+            _errorStack();
+            panic("runtime", "wrong number of arguments", sl);
+        }
+        // lexical scope: copy the env from the closure definition place
+        Env newEnv;
+        newEnv.reserve(closure.env.size() + callAndArgs.size() - 1);
+        newEnv.insert(newEnv.end(), closure.env.begin(), closure.env.end());
+        // closure call is pass by reference
+        newEnv.insert(newEnv.end(), callAndArgs.begin() + 1, callAndArgs.end());
+        return std::make_pair(closure.fun, std::move(newEnv));
+    }
+    // the closure is at resultLoc
+    Location _accessMember(const Node &anode) {
+        if (!_is<Closure>(resultLoc)) {
+            _errorStack();
+            panic("runtime", "@ wrong type", anode.sl);
+        }
+        const auto &closure = heap[resultLoc.index()].getClosure();
+        Symbol name = program->ast.nodes[anode.a].a;
+        auto captures = program->ast.captureList(program->ast.lambdas[closure.fun->d]);
+        for (std::size_t i = 0; i < captures.size(); i++) {
+            if (captures[i].name == name) {
+                // "access by reference"
+                return closure.env[i];
             }
-        } else if (auto inode = dynamic_cast<const IntrinsicCallNode*>(layer.expr)) {
-            // unified argument recording
-            if (layer.pc > 0 && layer.pc <= static_cast<int>(inode->argList.size())) {
-                layer.local.push_back(resultLoc);
+        }
+        _errorStack();
+        panic("runtime", "undefined variable " + program->symbols.name(name), anode.sl);
+        return Location();
+    }
+    // the arity is checked statically, so only the types are checked here
+    template <typename... Alt>
+    requires (true && ... && (std::same_as<Alt, Value> || Value::isType<Alt>))
+    void _typecheck(SourceLocation sl, [[maybe_unused]] std::span<const Location> args) {
+        int i = -1;
+        bool ok = (true && ... && (
+            i++,
+            [&] {
+                if constexpr (std::same_as<Alt, Value>) {
+                    return true;
+                } else {
+                    return _is<Alt>(args[i]);
+                }
+            } ()
+        ));
+        if (!ok) {
+            _errorStack();
+            panic("runtime", "type error on intrinsic call", sl);
+        }
+    }
+    // intrinsic dispatch
+    using IntrinsicHandler = Location (State::*)(SourceLocation, std::span<const Location>);
+    struct IntrinsicInfo {
+        std::string_view name;
+        int arity;
+        IntrinsicHandler handler;
+    };
+    // the table is indexed by Node::d of intrinsic calls (resolved during static analysis)
+    static const std::vector<IntrinsicInfo> intrinsics;
+    // Alt... is the type signature, checked before calling Impl;
+    // Impl either returns a new Value or the Location of an existing object (which is not copied)
+    template <auto Impl, typename... Alt>
+    Location _checkedIntrinsic(SourceLocation sl, std::span<const Location> args) {
+        _typecheck<Alt...>(sl, args);
+        if constexpr (std::same_as<decltype((this->*Impl)(sl, args)), Location>) {
+            return (this->*Impl)(sl, args);
+        } else {
+            return _moveNew((this->*Impl)(sl, args));
+        }
+    }
+    template <auto Impl, typename... Alt>
+    static constexpr IntrinsicInfo _intrinsic(std::string_view name) {
+        return IntrinsicInfo{name, sizeof...(Alt), &State::_checkedIntrinsic<Impl, Alt...>};
+    }
+    static std::optional<int> _resolveIntrinsic(std::string_view name) {
+        for (int i = 0; i < static_cast<int>(intrinsics.size()); i++) {
+            if (intrinsics[i].name == name) {
+                return i;
             }
-            // evaluate arguments
-            if (layer.pc < static_cast<int>(inode->argList.size())) {
-                layer.pc++;
-                stack.emplace_back(
-                    layer.env,
-                    inode->argList[layer.pc - 1]
-                );
-            // intrinsic call doesn't grow the stack
+        }
+        return std::nullopt;
+    }
+    Location _callIntrinsic(SourceLocation sl, int id, std::span<const Location> args) {
+        return (this->*(intrinsics[id].handler))(sl, args);
+    }
+    // intrinsic implementations
+    Value _void(SourceLocation, std::span<const Location>) {
+        return Void();
+    }
+    // integer arithmetic: machine words with overflow checks, falling back to BigInt
+    template <typename Op>
+    Value _integerOp(SourceLocation, std::span<const Location> args) {
+        if (!_isBigInt(args[0]) && !_isBigInt(args[1])) {
+            std::int64_t a = _getInteger(args[0]), b = _getInteger(args[1]), r = 0;
+            bool overflow = false;
+            if constexpr (std::same_as<Op, std::plus<>>) {
+                overflow = __builtin_add_overflow(a, b, &r);
+            } else if constexpr (std::same_as<Op, std::minus<>>) {
+                overflow = __builtin_sub_overflow(a, b, &r);
             } else {
-                auto value = _callIntrinsic(
-                    layer.expr->sl,
-                    inode->intrinsic,
-                    // intrinsic call is pass by reference
-                    layer.local
-                );
-                resultLoc = _moveNew(std::move(value));
-                stack.pop_back();
+                overflow = __builtin_mul_overflow(a, b, &r);
+            }
+            if (!overflow) {
+                return _makeInteger(r);
+            }
+        }
+        return _makeInteger(Op()(_getBigInt(args[0]), _getBigInt(args[1])));
+    }
+    template <typename Op>
+    Value _integerDivOp(SourceLocation sl, std::span<const Location> args) {
+        if (!_isBigInt(args[1]) && _getInteger(args[1]) == 0) {
+            panic("runtime", "division by zero", sl);
+        }
+        // small operands can't overflow (their range is narrower than int64_t)
+        if (!_isBigInt(args[0]) && !_isBigInt(args[1])) {
+            return _makeInteger(Op()(_getInteger(args[0]), _getInteger(args[1])));
+        }
+        return _makeInteger(Op()(_getBigInt(args[0]), _getBigInt(args[1])));
+    }
+    // integer comparison (results of Op are converted to Integer)
+    template <typename Op>
+    Value _integerCompare(SourceLocation, std::span<const Location> args) {
+        return Integer(Op()(_compareIntegers(args[0], args[1]), 0) ? 1 : 0);
+    }
+    // integer logic (results of Op are converted to Integer)
+    template <typename Op>
+    Value _integerLogic(SourceLocation, std::span<const Location> args) {
+        return Integer(Op()(_getInteger(args[0]) != 0, _getInteger(args[1]) != 0) ? 1 : 0);
+    }
+    Value _not(SourceLocation, std::span<const Location> args) {
+        return Integer(
+            _getInteger(args[0]) ? 0 : 1
+        );
+    }
+    Value _concat(SourceLocation, std::span<const Location> args) {
+        return String::concat(
+            heap[args[0].index()].getString(),
+            heap[args[1].index()].getString()
+        );
+    }
+    template <bool Equal>
+    Value _stringEqual(SourceLocation, std::span<const Location> args) {
+        return Integer(_stringEquals(args[0], args[1]) == Equal ? 1 : 0);
+    }
+    // string ordering (results are converted to Integer)
+    template <typename Op>
+    Value _stringCompare(SourceLocation, std::span<const Location> args) {
+        bool result = Op()(
+            heap[args[0].index()].getString().view(),
+            heap[args[1].index()].getString().view()
+        );
+        return Integer(result ? 1 : 0);
+    }
+    Value _length(SourceLocation, std::span<const Location> args) {
+        return Integer(
+            heap[args[0].index()].getString().size()
+        );
+    }
+    Location _substring(SourceLocation sl, std::span<const Location> args) {
+        std::int64_t n = heap[args[0].index()].getString().size();
+        std::int64_t l = _getInteger(args[1]);
+        std::int64_t r = _getInteger(args[2]);
+        if (!(
+            (0 <= l && l < n) &&
+            (0 <= r && r < n) &&
+            (l <= r)
+        )) {
+            panic("runtime", "invalid substring range", sl);
+        }
+        const auto &s = heap[args[0].index()].getString();
+        if (r - l == 1) {
+            return _charLocation(s.view()[l]);
+        }
+        return _moveNew(String::slice(s, l, r - l));
+    }
+    // the byte at an index (as an unsigned Integer)
+    Value _byteAt(SourceLocation sl, std::span<const Location> args) {
+        auto s = heap[args[0].index()].getString().view();
+        std::int64_t i = _getInteger(args[1]);
+        if (!(0 <= i && i < static_cast<std::int64_t>(s.size()))) {
+            _errorStack();
+            panic("runtime", "string index out of range", sl);
+        }
+        return Integer(static_cast<unsigned char>(s[i]));
+    }
+    // the one-character string of a byte (preallocated)
+    Location _byteToString(SourceLocation sl, std::span<const Location> args) {
+        std::int64_t c = _getInteger(args[0]);
+        if (!(0 <= c && c < 256)) {
+            _errorStack();
+            panic("runtime", "invalid byte", sl);
+        }
+        return _charLocation(static_cast<char>(c));
+    }
+    // the index of the first occurrence of a substring at or after an offset, or -1
+    Value _find(SourceLocation sl, std::span<const Location> args) {
+        auto s = heap[args[0].index()].getString().view();
+        auto t = heap[args[1].index()].getString().view();
+        std::int64_t from = _getInteger(args[2]);
+        if (!(0 <= from && from <= static_cast<std::int64_t>(s.size()))) {
+            _errorStack();
+            panic("runtime", "string index out of range", sl);
+        }
+        std::size_t pos = std::string_view::npos;
+        if (t.size() == 1) {
+            auto p = static_cast<const char *>(std::memchr(s.data() + from, t[0], s.size() - from));
+            pos = p ? p - s.data() : std::string_view::npos;
+        } else {
+            // (libstdc++ scans for the first character with memchr and then compares with memcmp)
+            pos = s.find(t, from);
+        }
+        return Integer(pos == std::string_view::npos ? -1 : static_cast<std::int64_t>(pos));
+    }
+    Value _quote(SourceLocation, std::span<const Location> args) {
+        return String(
+            quote(std::string(heap[args[0].index()].getString().view()))
+        );
+    }
+    Value _unquote(SourceLocation, std::span<const Location> args) {
+        return String(
+            unquote(std::string(heap[args[0].index()].getString().view()))
+        );
+    }
+    // like std::stoi: leading whitespace (std::isspace, e.g. '\r' of CRLF line endings) is skipped,
+    // and the characters after the digits are ignored
+    Value _stringToInteger(SourceLocation sl, std::span<const Location> args) {
+        auto s = heap[args[0].index()].getString().view();
+        std::size_t begin = 0;
+        while (begin < s.size() && std::isspace(static_cast<unsigned char>(s[begin]))) {
+            begin++;
+        }
+        std::size_t end = begin;
+        if (end < s.size() && (s[end] == '+' || s[end] == '-')) {
+            end++;
+        }
+        while (end < s.size() && isDigitChar(s[end])) {
+            end++;
+        }
+        auto v = _parseInteger(s.substr(begin, end - begin));
+        if (!v.has_value()) {
+            _errorStack();
+            panic("runtime", "invalid integer string", sl);
+        }
+        return std::move(v.value());
+    }
+    Value _integerToString(SourceLocation, std::span<const Location> args) {
+        if (_isBigInt(args[0])) {
+            return String(heap[args[0].index()].getBigInt().toString());
+        }
+        return String(
+            std::to_string(_getInteger(args[0]))
+        );
+    }
+    Value _newStringBuilder(SourceLocation, std::span<const Location>) {
+        return StringBuilder();
+    }
+    Value _appendStringBuilder(SourceLocation, std::span<const Location> args) {
+        return StringBuilder::append(
+            heap[args[0].index()].getStringBuilder(),
+            heap[args[1].index()].getString()
+        );
+    }
+    Value _finishStringBuilder(SourceLocation, std::span<const Location> args) {
+        return heap[args[0].index()].getStringBuilder().finish();
+    }
+    Value _newArray(SourceLocation sl, std::span<const Location> args) {
+        std::int64_t n = _getInteger(args[0]);
+        if (!(0 <= n && n <= std::numeric_limits<int>::max())) {
+            _errorStack();
+            panic("runtime", "invalid array length", sl);
+        }
+        // (lengths in range can still be too large to allocate)
+        try {
+            return Array(std::vector<Location>(n, args[1]));
+        } catch (const std::bad_alloc &) {
+            _errorStack();
+            panic("runtime", "array too large", sl);
+            return Void();
+        }
+    }
+    Value _arrayLength(SourceLocation, std::span<const Location> args) {
+        return Integer(heap[args[0].index()].getArray().elements().size());
+    }
+    // the element itself (not a copy)
+    Location _arrayGet(SourceLocation sl, std::span<const Location> args) {
+        const auto &elements = heap[args[0].index()].getArray().elements();
+        std::int64_t i = _getInteger(args[1]);
+        if (!(0 <= i && i < static_cast<std::int64_t>(elements.size()))) {
+            _errorStack();
+            panic("runtime", "array index out of range", sl);
+        }
+        return elements[i];
+    }
+    Value _arraySlice(SourceLocation sl, std::span<const Location> args) {
+        const auto &elements = heap[args[0].index()].getArray().elements();
+        std::int64_t n = elements.size();
+        std::int64_t l = _getInteger(args[1]);
+        std::int64_t r = _getInteger(args[2]);
+        if (!(0 <= l && l <= r && r <= n)) {
+            _errorStack();
+            panic("runtime", "invalid array slice range", sl);
+        }
+        return Array(std::vector<Location>(elements.begin() + l, elements.begin() + r));
+    }
+    // functional update: a new array with the i-th element replaced
+    Value _arraySet(SourceLocation sl, std::span<const Location> args) {
+        auto elements = heap[args[0].index()].getArray().elements();
+        std::int64_t i = _getInteger(args[1]);
+        if (!(0 <= i && i < static_cast<std::int64_t>(elements.size()))) {
+            _errorStack();
+            panic("runtime", "array index out of range", sl);
+        }
+        elements[i] = args[2];
+        return Array(std::move(elements));
+    }
+    // map keys are Integers or Strings
+    std::size_t _mapKeyHash(SourceLocation sl, Location key) {
+        if (_isBigInt(key)) {
+            return heap[key.index()].getBigInt().hash();
+        } else if (_is<Integer>(key)) {
+            // spread consecutive integers over the trie
+            return static_cast<std::uint64_t>(_getInteger(key)) * 0x9e3779b97f4a7c15ull;
+        } else if (_is<String>(key)) {
+            return heap[key.index()].getString().hash();
+        }
+        _errorStack();
+        panic("runtime", "type error on intrinsic call", sl);
+        return 0;
+    }
+    bool _mapKeyEquals(Location key1, Location key2) const {
+        bool integer1 = _is<Integer>(key1);
+        if (integer1 != _is<Integer>(key2)) {
+            return false;
+        } else if (integer1) {
+            return _compareIntegers(key1, key2) == 0;
+        }
+        return _stringEquals(key1, key2);
+    }
+    auto _mapKeyEqual() const {
+        return [this](Location key1, Location key2) { return _mapKeyEquals(key1, key2); };
+    }
+    Value _newMap(SourceLocation, std::span<const Location>) {
+        return Map();
+    }
+    Value _mapSize(SourceLocation, std::span<const Location> args) {
+        return Integer(heap[args[0].index()].getMap().size());
+    }
+    Value _mapInsert(SourceLocation sl, std::span<const Location> args) {
+        auto hash = _mapKeyHash(sl, args[1]);
+        return heap[args[0].index()].getMap().insert(hash, args[1], args[2], _mapKeyEqual());
+    }
+    Value _mapRemove(SourceLocation sl, std::span<const Location> args) {
+        auto hash = _mapKeyHash(sl, args[1]);
+        return heap[args[0].index()].getMap().remove(hash, args[1], _mapKeyEqual());
+    }
+    // the value itself (not a copy), or Void if the key is absent
+    Location _mapLookup(SourceLocation sl, std::span<const Location> args) {
+        auto hash = _mapKeyHash(sl, args[1]);
+        return heap[args[0].index()].getMap().find(hash, args[1], _mapKeyEqual()).value_or(VOID_LOCATION);
+    }
+    Value _mapContains(SourceLocation sl, std::span<const Location> args) {
+        auto hash = _mapKeyHash(sl, args[1]);
+        return Integer(heap[args[0].index()].getMap().find(hash, args[1], _mapKeyEqual()).has_value() ? 1 : 0);
+    }
+    // the keys in an Array (in hash order)
+    Value _mapKeys(SourceLocation, std::span<const Location> args) {
+        const auto &map = heap[args[0].index()].getMap();
+        std::vector<Location> keys;
+        keys.reserve(map.size());
+        map.forEach([&keys](Location key, Location) { keys.push_back(key); });
+        return Array(std::move(keys));
+    }
+    Value _type(SourceLocation, std::span<const Location> args) {
+        int label = -1;
+        if (_is<Void>(args[0])) {
+            label = 0;
+        } else if (_is<Integer>(args[0])) {
+            label = 1;
+        } else if (_is<String>(args[0])) {
+            label = 2;
+        } else if (_is<Closure>(args[0])) {
+            label = 3;
+        } else if (_is<StringBuilder>(args[0])) {
+            label = 4;
+        } else if (_is<Array>(args[0])) {
+            label = 5;
+        } else {
+            label = 6;
+        }
+        return Integer(label);
+    }
+    // the nested state (and its heap) is gone on return, so the result is copied into this heap
+    Value _eval(SourceLocation sl, std::span<const Location> args) {
+        State state(std::string(heap[args[0].index()].getString().view()), engine);
+        state.setGcBudget(gcBudget);
+        state.setGcThreads(gcThreads);
+        state.execute();
+        return _load(_import(sl, state, state.resultLoc));
+    }
+    // copies the object at loc of another state into this heap, with the objects it references;
+    // arrays and maps get their cells first and their contents afterwards, since references can be shared
+    // or form cycles (through letrec placeholders); closures refer to the other state's program, so they are rejected
+    Location _import(SourceLocation sl, const State &other, Location loc) {
+        if (loc.isImmediate()) {
+            return loc;
+        }
+        std::unordered_map<int, Location> copies;
+        std::vector<int> pending{loc.index()};
+        std::vector<int> containers;
+        auto push = [&pending](Location l) {
+            if (!l.isImmediate()) {
+                pending.push_back(l.index());
             }
-        } else if (auto enode = dynamic_cast<const ExprCallNode*>(layer.expr)) {
-            // unified argument recording
-            if (layer.pc > 2 && layer.pc <= static_cast<int>(enode->argList.size()) + 2) {
-                layer.local.push_back(resultLoc);
+        };
+        while (!pending.empty()) {
+            int index = pending.back();
+            pending.pop_back();
+            if (copies.contains(index)) {
+                continue;
             }
-            // evaluate the callee
-            if (layer.pc == 0) {
-                layer.pc++;
-                stack.emplace_back(
-                    layer.env,
-                    enode->expr
-                );
-            // initialization
-            } else if (layer.pc == 1) {
-                layer.pc++;
-                // inherited callee location
-                layer.local.push_back(resultLoc);
-            // evaluate arguments
-            } else if (layer.pc <= static_cast<int>(enode->argList.size()) + 1) {
-                layer.pc++;
-                stack.emplace_back(
-                    layer.env,
-                    enode->argList[layer.pc - 3]
-                );
-            // call
-            } else if (layer.pc == static_cast<int>(enode->argList.size()) + 2) {
-                layer.pc++;
-                auto exprLoc = layer.local[0];
-                if (!std::holds_alternative<Closure>(heap[exprLoc])) {
-                    _errorStack();
-                    panic("runtime", "calling a non-callable", layer.expr->sl);
-                }
-                auto &closure = std::get<Closure>(heap[exprLoc]);
-                // types will be checked inside the closure call
-                if (
-                    static_cast<int>(layer.local.size()) - 1 !=
-                    static_cast<int>(closure.fun->varList.size())
-                ) {
-                    _errorStack();
-                    panic("runtime", "wrong number of arguments", layer.expr->sl);
-                }
-                int nArgs = static_cast<int>(closure.fun->varList.size());
-                // lexical scope: copy the env from the closure definition place
-                auto newEnv = closure.env;
-                for (int i = 0; i < nArgs; i++) {
-                    // closure call is pass by reference
-                    newEnv.push_back(std::make_pair(
-                        closure.fun->varList[i]->name,
-                        layer.local[i + 1]
-                    ));
-                }
-                // tail call optimization
-                if (enode->tail) {
-                    while (!(stack.back().frame)) {
-                        stack.pop_back();
-                    }
-                    // pop the frame
-                    stack.pop_back();
+            const auto &v = other.heap[index];
+            if (v.is<Closure>()) {
+                _errorStack();
+                panic("runtime", "closure returned from .eval", sl);
+            } else if (v.is<Array>()) {
+                copies[index] = _new<Void>();
+                containers.push_back(index);
+                for (auto element : v.getArray().elements()) {
+                    push(element);
                 }
-                // evaluation of the closure body
-                stack.emplace_back(
-                    // new frame has new env
-                    std::make_shared<Env>(std::move(newEnv)),
-                    closure.fun->expr,
-                    true
-                );
-            // finish
+            } else if (v.is<Map>()) {
+                copies[index] = _new<Void>();
+                containers.push_back(index);
+                v.getMap().forEach([&push](Location key, Location value) {
+                    push(key);
+                    push(value);
+                });
             } else {
-                // no need to update resultLoc: inherited
-                stack.pop_back();
+                copies[index] = _moveNew(other._load(Location::cell(index)));
             }
-        } else if (auto anode = dynamic_cast<const AtNode*>(layer.expr)) {
-            // evaluate the expr
-            if (layer.pc == 0) {
-                layer.pc++;
-                stack.emplace_back(layer.env, anode->expr);
-            } else {
-                // inherited resultLoc
-                if (!std::holds_alternative<Closure>(heap[resultLoc])) {
-                    _errorStack();
-                    panic("runtime", "@ wrong type", layer.expr->sl);
-                }
-                auto varName = anode->var->name;
-                auto loc = lookup(
-                    varName,
-                    std::get<Closure>(heap[resultLoc]).env
-                );
-                if (!loc.has_value()) {
-                    _errorStack();
-                    panic("runtime", "undefined variable " + varName, layer.expr->sl);
+        }
+        auto translate = [&copies](Location l) {
+            return l.isImmediate() ? l : copies.at(l.index());
+        };
+        // (the keys are Integers or Strings, which are already copied when they are hashed here)
+        for (int index : containers) {
+            const auto &v = other.heap[index];
+            if (v.is<Array>()) {
+                auto elements = v.getArray().elements();
+                for (auto &element : elements) {
+                    element = translate(element);
                 }
-                // "access by reference"
-                resultLoc = loc.value();
-                stack.pop_back();
+                heap[copies.at(index).index()] = Array(std::move(elements));
+            } else {
+                Map map;
+                v.getMap().forEach([&](Location key, Location value) {
+                    key = translate(key);
+                    map = map.insert(_mapKeyHash(sl, key), key, translate(value), _mapKeyEqual());
+                });
+                heap[copies.at(index).index()] = std::move(map);
             }
+        }
+        return translate(loc);
+    }
+    Location _getchar(SourceLocation, std::span<const Location>) {
+        auto c = std::cin.get();
+        if (std::cin.eof()) {
+            return VOID_LOCATION;
         } else {
-            _errorStack();
-            panic("runtime", "unrecognized AST node", layer.expr->sl);
+            return _charLocation(static_cast<char>(c));
         }
-        return true;
     }
-    void execute() {
-        // can choose different initial values here
-        int gc_threshold = numLiterals + 64;
-        while (step()) {
-            int total = heap.size();
-            if (total > gc_threshold) {
-                int removed = _gc();
-                int live = total - removed;
-                // see also "Optimal heap limits for reducing browser memory use" (OOPSLA 2022)
-                // for the square root solution
-                gc_threshold = live * 2;
-            }
+    // like std::cin >> v: leading spaces are skipped, and reading stops at the first non-digit
+    Value _getint(SourceLocation, std::span<const Location>) {
+        std::string s;
+        std::cin >> std::ws;
+        if (std::cin.peek() == '+' || std::cin.peek() == '-') {
+            s.push_back(static_cast<char>(std::cin.get()));
+        }
+        while (isDigitChar(static_cast<char>(std::cin.peek()))) {
+            s.push_back(static_cast<char>(std::cin.get()));
+        }
+        auto v = _parseInteger(s);
+        if (v.has_value()) {
+            return std::move(v.value());
+        } else {
+            return Void();
         }
     }
-    const Value &getResult() const {
-        return heap[resultLoc];
+    Value _putstr(SourceLocation, std::span<const Location> args) {
+        heap[args[0].index()].getString().forEachPiece([](std::string_view piece) {
+            std::cout << piece;
+        });
+        return Void();
     }
-private:
-    template <typename... Alt>
-    requires (true && ... && (std::same_as<Alt, Value> || isAlternativeOf<Alt, Value>))
-    void _typecheck(SourceLocation sl, const std::vector<Location> &args) {
-        bool ok = args.size() == sizeof...(Alt);
-        int i = -1;
-        ok = ok && (true && ... && (
-            i++,
-            [&] {
-                if constexpr (std::same_as<Alt, Value>) {
-                    return true;
-                } else {
-                    return std::holds_alternative<Alt>(heap[args[i]]);
-                }
-            } ()
-        ));
-        if (!ok) {
-            _errorStack();
-            panic("runtime", "type error on intrinsic call", sl);
+    Value _flush(SourceLocation, std::span<const Location>) {
+        std::cout << std::flush;
+        return Void();
+    }
+    // value access (integers may be immediates, everything else lives on the heap)
+    template <typename T>
+    requires Value::isType<T>
+    bool _is(Location loc) const {
+        if (loc.isImmediate()) {
+            return std::same_as<T, Integer>;
+        } else if constexpr (std::same_as<T, Integer>) {
+            // both representations
+            return heap[loc.index()].is<Integer>() || heap[loc.index()].is<BigInt>();
         }
+        return heap[loc.index()].is<T>();
     }
-    // intrinsic dispatch
-    Value _callIntrinsic(
-        SourceLocation sl, const std::string &name, const std::vector<Location> &args
-    ) {
-        if (name == ".void") {
-            _typecheck<>(sl, args);
-            return Void();
-        } else if (name == ".+") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value +
-                std::get<Integer>(heap[args[1]]).value
-            );
-        } else if (name == ".-") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value -
-                std::get<Integer>(heap[args[1]]).value
-            );
-        } else if (name == ".*") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value *
-                std::get<Integer>(heap[args[1]]).value
-            );
-        } else if (name == "./") {
-            _typecheck<Integer, Integer>(sl, args);
-            int d = std::get<Integer>(heap[args[1]]).value;
-            if (d == 0) {
-                panic("runtime", "division by zero", sl);
-            }
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value /
-                d
-            );
-        } else if (name == ".%") {
-            _typecheck<Integer, Integer>(sl, args);
-            int d = std::get<Integer>(heap[args[1]]).value;
-            if (d == 0) {
-                panic("runtime", "division by zero", sl);
-            }
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value %
-                d
-            );
-        } else if (name == ".<") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value <
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".<=") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value <=
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".>") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value >
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".>=") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value >=
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".=") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value ==
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == "./=") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value !=
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".and") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value &&
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".or") {
-            _typecheck<Integer, Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value ||
-                std::get<Integer>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".not") {
-            _typecheck<Integer>(sl, args);
-            return Integer(
-                std::get<Integer>(heap[args[0]]).value ? 0 : 1
-            );
-        } else if (name == ".s+") {
-            _typecheck<String, String>(sl, args);
-            return String(
-                std::get<String>(heap[args[0]]).value +
-                std::get<String>(heap[args[1]]).value
-            );
-        } else if (name == ".s<") {
-            _typecheck<String, String>(sl, args);
-            return Integer(
-                std::get<String>(heap[args[0]]).value <
-                std::get<String>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".s<=") {
-            _typecheck<String, String>(sl, args);
-            return Integer(
-                std::get<String>(heap[args[0]]).value <=
-                std::get<String>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".s>") {
-            _typecheck<String, String>(sl, args);
-            return Integer(
-                std::get<String>(heap[args[0]]).value >
-                std::get<String>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".s>=") {
-            _typecheck<String, String>(sl, args);
-            return Integer(
-                std::get<String>(heap[args[0]]).value >=
-                std::get<String>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".s=") {
-            _typecheck<String, String>(sl, args);
-            return Integer(
-                std::get<String>(heap[args[0]]).value ==
-                std::get<String>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".s/=") {
-            _typecheck<String, String>(sl, args);
-            return Integer(
-                std::get<String>(heap[args[0]]).value !=
-                std::get<String>(heap[args[1]]).value ? 1 : 0
-            );
-        } else if (name == ".s||") {
-            _typecheck<String>(sl, args);
-            return Integer(
-                std::get<String>(heap[args[0]]).value.size()
-            );
-        } else if (name == ".s[]") {
-            _typecheck<String, Integer, Integer>(sl, args);
-            int n = std::get<String>(heap[args[0]]).value.size();
-            int l = std::get<Integer>(heap[args[1]]).value;
-            int r = std::get<Integer>(heap[args[2]]).value;
-            if (!(
-                (0 <= l && l < n) &&
-                (0 <= r && r < n) &&
-                (l <= r)
-            )) {
-                panic("runtime", "invalid substring range", sl);
-            }
-            return String(
-                std::get<String>(heap[args[0]]).value.substr(l, r - l)
-            );
-        } else if (name == ".quote") {
-            _typecheck<String>(sl, args);
-            return String(
-                quote(std::get<String>(heap[args[0]]).value)
-            );
-        } else if (name == ".unquote") {
-            _typecheck<String>(sl, args);
-            return String(
-                unquote(std::get<String>(heap[args[0]]).value)
-            );
-        } else if (name == ".s->i") {
-            _typecheck<String>(sl, args);
-            return Integer(
-                std::stoi(std::get<String>(heap[args[0]]).value)  // TODO: exceptions
-            );
-        } else if (name == ".i->s") {
-            _typecheck<Integer>(sl, args);
-            return String(
-                std::to_string(std::get<Integer>(heap[args[0]]).value)
-            );
-        } else if (name == ".type") {
-            _typecheck<Value>(sl, args);
-            int label = -1;
-            if (std::holds_alternative<Void>(heap[args[0]])) {
-                label = 0;
-            } else if (std::holds_alternative<Integer>(heap[args[0]])) {
-                label = 1;
-            } else {
-                label = 2;
-            }
-            return Integer(label);
-        } else if (name == ".eval") {
-            _typecheck<String>(sl, args);
-            State state(std::get<String>(heap[args[0]]).value);
-            state.execute();
-            return state.getResult();  // this should be a copy
-        } else if (name == ".getchar") {
-            _typecheck<>(sl, args);
-            auto c = std::cin.get();
-            if (std::cin.eof()) {
-                return Void();
-            } else {
-                std::string s;
-                s.push_back(static_cast<char>(c));
-                return String(s);
-            }
-        } else if (name == ".getint") {
-            _typecheck<>(sl, args);
-            int v;
-            if (std::cin >> v) {
-                return Integer(v);
-            } else {
-                return Void();
+    // the caller must check the type first (BigInts saturate, which keeps range checks and truth tests valid)
+    std::int64_t _getInteger(Location loc) const {
+        if (loc.isImmediate()) {
+            return loc.integer();
+        } else if (heap[loc.index()].is<BigInt>()) {
+            return heap[loc.index()].getBigInt().isNegative() ? INT64_MIN : INT64_MAX;
+        }
+        return heap[loc.index()].getInteger().value;
+    }
+    static Location _charLocation(char c) {
+        return Location::cell(CHARS_BASE + static_cast<unsigned char>(c));
+    }
+    bool _isBigInt(Location loc) const {
+        return !loc.isImmediate() && heap[loc.index()].is<BigInt>();
+    }
+    BigInt _getBigInt(Location loc) const {
+        return _isBigInt(loc) ? heap[loc.index()].getBigInt() : BigInt(_getInteger(loc));
+    }
+    int _compareIntegers(Location loc1, Location loc2) const {
+        if (!_isBigInt(loc1) && !_isBigInt(loc2)) {
+            auto a = _getInteger(loc1), b = _getInteger(loc2);
+            return (a > b) - (a < b);
+        }
+        return BigInt::compare(_getBigInt(loc1), _getBigInt(loc2));
+    }
+    // every integer has one representation: Integer if it fits, otherwise BigInt
+    static Value _makeInteger(std::int64_t v) {
+        if (Integer::fits(v)) {
+            return Integer(v);
+        }
+        return BigInt(v);
+    }
+    static Value _makeInteger(BigInt v) {
+        auto small = v.toInt64();
+        if (small.has_value() && Integer::fits(small.value())) {
+            return Integer(small.value());
+        }
+        return v;
+    }
+    // parses [+-]?[0-9]+ (machine words on the fast path)
+    static std::optional<Value> _parseInteger(std::string_view s) {
+        bool negative = !s.empty() && s[0] == '-';
+        auto digits = (!s.empty() && (s[0] == '+' || s[0] == '-')) ? s.substr(1) : s;
+        if (digits.empty() || !std::all_of(digits.begin(), digits.end(), isDigitChar)) {
+            return std::nullopt;
+        }
+        if (digits.size() <= 18) {
+            std::int64_t v = 0;
+            for (char c : digits) {
+                v = v * 10 + (c - '0');
             }
-        } else if (name == ".putstr") {
-            _typecheck<String>(sl, args);
-            std::cout << std::get<String>(heap[args[0]]).value;
-            return Void();
-        } else if (name == ".flush") {
-            _typecheck<>(sl, args);
-            std::cout << std::flush;
-            return Void();
-        } else {
-            _errorStack();
-            panic("runtime", "unrecognized intrinsic call", sl);
-            return Void();
+            return _makeInteger(negative ? -v : v);
+        }
+        return _makeInteger(BigInt::parse(digits, negative));
+    }
+    // a copy of the object (a loaded String is a new string, which is not interned)
+    Value _load(Location loc) const {
+        if (loc.isImmediate()) {
+            return Integer(loc.integer());
+        }
+        Value v = heap[loc.index()];
+        if (v.is<String>()) {
+            v.getString().interned = false;
         }
+        return v;
     }
     // memory management
     template <typename V, typename... Args>
-    requires isAlternativeOf<V, Value>
+    requires Value::isType<V>
     Location _new(Args&&... args) {
+        stats.allocations++;
         heap.push_back(std::move(V(std::forward<Args>(args)...)));
-        return heap.size() - 1;
+        return Location::cell(heap.size() - 1);
     }
+    // integers are not allocated unless they are out of the immediate range,
+    // and Void is never allocated (use _new<Void>() for a fresh cell)
     Location _moveNew(Value v) {
+        if (v.is<Integer>() && Location::fitsImmediate(v.getInteger().value)) {
+            return Location::immediate(static_cast<int>(v.getInteger().value));
+        } else if (v.is<Void>()) {
+            return VOID_LOCATION;
+        } else if (v.is<String>() && v.getString().size() <= INTERN_LIMIT) {
+            return _intern(std::move(v));
+        }
+        stats.allocations++;
         heap.push_back(std::move(v));
-        return heap.size() - 1;
-    }
-    std::unordered_set<Location> _mark() {
-        std::unordered_set<Location> visited;
-        // for each traversed location, specifically handle the closure case
-        std::function<void(Location)> traverseLocation =
-            // "this" captures the current object by reference
-            [this, &visited, &traverseLocation](Location loc) {
-            if (!(visited.contains(loc))) {
-                visited.insert(loc);
-                if (std::holds_alternative<Closure>(heap[loc])) {
-                    for (const auto &[_, l] : std::get<Closure>(heap[loc]).env) {
-                        traverseLocation(l);
-                    }
-                }
+        return Location::cell(heap.size() - 1);
+    }
+    // returns the existing cell of an equal interned string, or allocates and registers a new one
+    Location _intern(Value v) {
+        auto &s = v.getString();
+        auto iter = interned.find(s.view());
+        if (iter != interned.end()) {
+            if (gcPhase != GcPhase::idle) {
+                _shade(iter->second);
             }
-        };
-        // traverse the stack
-        for (const auto &layer : stack) {
+            return iter->second;
+        }
+        s.interned = true;
+        s.hash();
+        Location loc = Location::cell(heap.size());
+        interned.emplace(s.view(), loc);
+        stats.allocations++;
+        heap.push_back(std::move(v));
+        return loc;
+    }
+    bool _stringEquals(Location loc1, Location loc2) const {
+        if (loc1 == loc2) {
+            return true;
+        }
+        const auto &s1 = heap[loc1.index()].getString();
+        const auto &s2 = heap[loc2.index()].getString();
+        if (s1.interned && s2.interned) {
+            return false;
+        }
+        return s1.size() == s2.size() && s1.hash() == s2.hash() && s1.view() == s2.view();
+    }
+    // the heap is [literals | old generation | nursery]: every allocation goes to the nursery,
+    // and a minor collection promotes the surviving nursery objects to the old generation;
+    // objects are immutable except letrec placeholders, so an old object can only point into the nursery
+    // after it is patched (the write barrier records such cells in the remembered set)
+    void _patch(Location loc, Location value) {
+        heap[loc.index()] = _load(value);
+        if (loc.index() < nurseryStart) {
+            remembered.push_back(loc.index());
+        }
+    }
+    // calls f on each reference held by an object (the stamp identifies the traversal of shared map nodes)
+    template <typename F>
+    void _forEachChild(Value &v, std::uint64_t stamp, F &&f) {
+        if (v.is<Closure>()) {
+            for (auto &loc : v.getClosure().env) {
+                f(loc);
+            }
+        } else if (v.is<Array>()) {
+            v.getArray().forEachReference(stamp, f);
+        } else if (v.is<Map>()) {
+            v.getMap().forEachReference(stamp, f);
+        }
+    }
+    // calls f on each root
+    template <typename F>
+    void _forEachRoot(F &&f) {
+        _forEachLayerRoot(0, stack.size(), f);
+        // traverse the resultLoc
+        f(resultLoc);
+    }
+    // calls f on each root held by the stack layers [begin, end)
+    template <typename F>
+    void _forEachLayerRoot(int begin, int end, F &&f) {
+        for (int i = begin; i < end; i++) {
+            auto &layer = stack[i];
             // only frames "own" the environments
             if (layer.frame) {
-                for (const auto &[_, loc] : (*(layer.env))) {
-                    traverseLocation(loc);
+                for (auto &loc : (*(layer.env))) {
+                    f(loc);
                 }
             }
             // but each layer can still have locals
-            for (const auto v : layer.local) {
-                traverseLocation(v);
+            for (auto &v : layer.local) {
+                f(v);
             }
         }
-        // traverse the resultLoc
-        traverseLocation(resultLoc);
+    }
+    // marks the reachable cells at or above the boundary (cells below it are neither marked nor traversed);
+    // the traversal uses an explicit stack, so long chains of objects do not overflow the native stack
+    MarkBitmap _mark(int boundary) {
+        MarkBitmap visited;
+        visited.reset(boundary, heap.size());
+        auto stamp = ++gcStamp;
+        auto push = [this, &visited, boundary](Location &loc) {
+            if (!loc.isImmediate() && loc.index() >= boundary && visited.insert(loc.index())) {
+                // the cell is scanned soon (the stack is LIFO)
+                __builtin_prefetch(&heap[loc.index()]);
+                markStack.push_back(loc.index());
+            }
+        };
+        _forEachRoot(push);
+        // remembered old cells are roots of a minor collection
+        if (boundary == nurseryStart) {
+            for (auto index : remembered) {
+                _forEachChild(heap[index], stamp, push);
+            }
+        }
+        while (!markStack.empty()) {
+            int index = markStack.back();
+            markStack.pop_back();
+            _forEachChild(heap[index], stamp, push);
+        }
         return visited;
     }
-    std::pair<int, std::unordered_map<Location, Location>>
-        _sweepAndCompact(const std::unordered_set<Location> &visited) {
-        std::unordered_map<Location, Location> relocation;
-        Location n = heap.size();
-        Location i{numLiterals}, j{numLiterals};
-        while (j < n) {
-            if (visited.contains(j)) {
-                if (i < j) {
-                    heap[i] = std::move(heap[j]);
-                    relocation[j] = i;
+    // trims the spare capacity of a surviving string or builder
+    static void _compactPayload(Value &v) {
+        if (v.is<String>()) {
+            v.getString().compact();
+        } else if (v.is<StringBuilder>()) {
+            v.getStringBuilder().compact();
+        }
+    }
+    // collects the cells at or above the boundary and promotes the survivors
+    int _collect(int boundary) {
+        if (_parallelCollection(boundary)) {
+            return _parallelCompact(_parallelMark(boundary), boundary);
+        }
+        return _compact(_mark(boundary), boundary);
+    }
+    // slides the marked cells at or above the boundary down, fixing up their references on the way
+    // (one pass over the bitmap; the new index of every cell is known upfront, see MarkBitmap::forward);
+    // a minor collection first moves the survivors into the free cells left by incremental sweeping,
+    // and slides only the others down
+    int _compact(MarkBitmap visited, int boundary) {
+        visited.computeForwarding();
+        std::span<const int> holes;
+        if (boundary == nurseryStart) {
+            holes = std::span<const int>(freeCells).last(
+                std::min<std::size_t>(freeCells.size(), visited.population(0, visited.wordCount()))
+            );
+        }
+        int taken = holes.size();
+        // the new index of the k-th survivor (in index order) at or above the boundary
+        auto destination = [holes, taken, boundary](int k) {
+            return k < taken ? holes[k] : boundary + k - taken;
+        };
+        auto stamp = ++gcStamp;
+        auto fix = [&visited, &destination, boundary](Location &loc) {
+            if (!loc.isImmediate() && loc.index() >= boundary) {
+                loc = Location::cell(destination(visited.forward(loc.index()) - boundary));
+            }
+        };
+        _forEachRoot(fix);
+        // only remembered cells can hold references from below the boundary to moved cells
+        // (remembered cells at or above the boundary are fixed up below with the others, and must not be fixed up twice)
+        for (auto index : remembered) {
+            if (index < boundary) {
+                _forEachChild(heap[index], stamp, fix);
+            }
+        }
+        int n = heap.size();
+        int i{boundary};
+        // a word of the bitmap at a time (visited.begin() == boundary)
+        for (int k = 0, base = boundary; base < n; k++, base += 64) {
+            auto valid = n - base >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << (n - base)) - 1;
+            auto live = visited.word(k) & valid;
+            // the intern table is weak: entries of unreachable strings are dropped, and the others follow their cells
+            // (the dead cells are released before the live cells of the word are moved over them)
+            for (auto dead = ~live & valid; dead; dead &= dead - 1) {
+                auto &v = heap[base + std::countr_zero(dead)];
+                if (v.is<String>() && v.getString().interned) {
+                    interned.erase(interned.find(v.getString().view()));
+                }
+            }
+            for (; live; live &= live - 1) {
+                int j = base + std::countr_zero(live);
+                int to = destination(i - boundary);
+                _compactPayload(heap[j]);
+                _forEachChild(heap[j], stamp, fix);
+                if (to != j) {
+                    if (heap[j].is<String>() && heap[j].getString().interned) {
+                        interned.find(heap[j].getString().view())->second = Location::cell(to);
+                    }
+                    heap[to] = std::move(heap[j]);
                 }
                 i++;
             }
-            j++;
         }
-        heap.resize(i);
-        return std::make_pair(n - i, std::move(relocation));
+        heap.resize(i - taken);
+        freeCells.resize(freeCells.size() - taken);
+        nurseryStart = heap.size();
+        remembered.clear();
+        return n - i;
+    }
+    // the parallel collector (opt-in with gcThreads > 1) marks and compacts exactly like the serial one,
+    // so the resulting heap is the same; only large regions are worth starting the threads for
+    bool _parallelCollection(int boundary) const {
+        return gcThreads > 1 && static_cast<int>(heap.size()) - boundary >= PARALLEL_MIN_CELLS;
     }
-    void _relocate(const std::unordered_map<Location, Location> &relocation) {
-        auto reloc = [&relocation](Location &loc) -> void {
-            if (relocation.contains(loc)) {
-                loc = relocation.at(loc);
+    // runs f(t) for each thread t in [0, gcThreads) (thread 0 is the calling thread)
+    template <typename F>
+    void _parallel(F &&f) {
+        gcWorkers.run(gcThreads, std::ref(f));
+    }
+    // runs f(t, begin, end) on a chunk of [0, n) for each thread t (the chunks are in order of t)
+    template <typename F>
+    void _parallelFor(int n, F &&f) {
+        _parallel([this, n, &f](int t) {
+            f(t, static_cast<long long>(n) * t / gcThreads, static_cast<long long>(n) * (t + 1) / gcThreads);
+        });
+    }
+    // marking with work stealing: each thread traces from a private stack, and shares the older half of it
+    // through its deque when the deque is empty; an idle thread steals half of a deque,
+    // and the threads stop when all of them are idle and all deques are empty
+    MarkBitmap _parallelMark(int boundary) {
+        struct MarkDeque {
+            std::mutex mutex;
+            std::vector<int> cells;
+            std::atomic<std::size_t> size = 0;
+        };
+        MarkBitmap visited;
+        visited.reset(boundary, heap.size());
+        auto stamp = ++gcStamp;
+        std::vector<MarkDeque> deques(gcThreads);
+        int next = 0;
+        auto pushRoot = [this, &visited, &deques, &next, boundary](Location &loc) {
+            if (!loc.isImmediate() && loc.index() >= boundary && visited.insert(loc.index())) {
+                auto &deque = deques[next++ % gcThreads];
+                deque.cells.push_back(loc.index());
+                deque.size = deque.cells.size();
             }
         };
-        // traverse the stack
-        for (auto &layer : stack) {
-            // only frames "own" the environments
-            if (layer.frame) {
-                for (auto &[_, loc] : (*(layer.env))) {
-                    reloc(loc);
+        _forEachRoot(pushRoot);
+        if (boundary == nurseryStart) {
+            for (auto index : remembered) {
+                _forEachChild(heap[index], stamp, pushRoot);
+            }
+        }
+        std::atomic<int> busy = gcThreads;
+        auto steal = [&deques](int t, std::vector<int> &local) {
+            for (std::size_t i = 0; i < deques.size(); i++) {
+                auto &deque = deques[(t + i) % deques.size()];
+                if (deque.size > 0) {
+                    std::lock_guard lock(deque.mutex);
+                    auto half = deque.cells.begin() + deque.cells.size() / 2;
+                    local.insert(local.end(), half, deque.cells.end());
+                    deque.cells.erase(half, deque.cells.end());
+                    deque.size = deque.cells.size();
+                    if (!local.empty()) {
+                        return true;
+                    }
                 }
             }
-            // but each layer can still have locals
-            for (auto &v : layer.local) {
-                reloc(v);
+            return false;
+        };
+        _parallel([&](int t) {
+            std::vector<int> local;
+            auto push = [this, &visited, &local, boundary](Location &loc) {
+                if (!loc.isImmediate() && loc.index() >= boundary && visited.insertAtomic(loc.index())) {
+                    __builtin_prefetch(&heap[loc.index()]);
+                    local.push_back(loc.index());
+                }
+            };
+            auto &own = deques[t];
+            while (true) {
+                while (!local.empty()) {
+                    int index = local.back();
+                    local.pop_back();
+                    _forEachChild(heap[index], stamp, push);
+                    if (local.size() >= MARK_SHARE_SIZE && own.size == 0) {
+                        std::lock_guard lock(own.mutex);
+                        auto half = local.begin() + local.size() / 2;
+                        own.cells.insert(own.cells.end(), local.begin(), half);
+                        local.erase(local.begin(), half);
+                        own.size = own.cells.size();
+                    }
+                }
+                if (steal(t, local)) {
+                    continue;
+                }
+                busy--;
+                while (true) {
+                    if (std::any_of(deques.begin(), deques.end(), [](const MarkDeque &d) { return d.size > 0; })) {
+                        busy++;
+                        break;
+                    }
+                    if (busy == 0) {
+                        return;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        });
+        return visited;
+    }
+    // _compact() in parallel chunks of the bitmap: the ranks come from a parallel prefix sum,
+    // the references of the stack and the live cells are fixed up in place, the intern table is updated
+    // (serially), and the live cells are slid down in place
+    int _parallelCompact(MarkBitmap visited, int boundary) {
+        int n = heap.size();
+        int words = visited.wordCount();
+        std::vector<int> ranks(gcThreads + 1, 0);
+        visited.prepareForwarding();
+        _parallelFor(words, [&](int t, int begin, int end) { ranks[t + 1] = visited.population(begin, end); });
+        std::partial_sum(ranks.begin(), ranks.end(), ranks.begin());
+        _parallelFor(words, [&](int t, int begin, int end) { visited.number(begin, end, ranks[t]); });
+        auto stamp = ++gcStamp;
+        auto fix = [&visited](Location &loc) {
+            if (!loc.isImmediate()) {
+                loc = Location::cell(visited.forward(loc.index()));
+            }
+        };
+        _parallelFor(stack.size(), [&](int, int begin, int end) { _forEachLayerRoot(begin, end, fix); });
+        fix(resultLoc);
+        for (auto index : remembered) {
+            if (index < boundary) {
+                _forEachChild(heap[index], stamp, fix);
             }
         }
-        // traverse the resultLoc
-        reloc(resultLoc);
-        // traverse the closure values
-        for (auto &v : heap) {
-            if (std::holds_alternative<Closure>(v)) {
-                auto &c = std::get<Closure>(v);
-                for (auto &[_, loc] : c.env) {
-                    reloc(loc);
+        // calls f(j, live) on each cell j at or above the boundary covered by the words [begin, end)
+        auto forEachCell = [n, boundary, &visited](int begin, int end, auto &&f) {
+            for (int k = begin; k < end; k++) {
+                int base = boundary + k * 64;
+                auto valid = n - base >= 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << (n - base)) - 1;
+                auto live = visited.word(k) & valid;
+                for (auto bits = valid; bits; bits &= bits - 1) {
+                    int j = base + std::countr_zero(bits);
+                    f(j, (live >> (j - base)) & 1);
+                }
+            }
+        };
+        std::vector<std::vector<int>> internedCells(gcThreads);
+        _parallelFor(words, [&](int t, int begin, int end) {
+            forEachCell(begin, end, [&](int j, bool live) {
+                auto &v = heap[j];
+                if (live) {
+                    _compactPayload(v);
+                    _forEachChild(v, stamp, fix);
+                }
+                if (v.is<String>() && v.getString().interned) {
+                    internedCells[t].push_back(j);
+                }
+            });
+        });
+        for (const auto &cells : internedCells) {
+            for (int j : cells) {
+                auto iter = interned.find(heap[j].getString().view());
+                if (visited.contains(j)) {
+                    iter->second = Location::cell(visited.forward(j));
+                } else {
+                    interned.erase(iter);
                 }
             }
         }
+        // a cell only moves down, onto a cell of its own chunk or of an earlier one, so the chunks are taken in order,
+        // and a chunk waits until the earlier chunks whose cells it overwrites are done
+        // (the earliest unfinished chunk never waits, so the threads always make progress)
+        int chunks = std::min(words, gcThreads * MOVE_CHUNKS_PER_THREAD);
+        auto chunkBegin = [words, chunks](int c) {
+            return static_cast<int>(static_cast<long long>(words) * c / chunks);
+        };
+        std::vector<std::atomic<bool>> done(chunks);
+        std::atomic<int> next = 0;
+        _parallel([&](int) {
+            for (int c = next++; c < chunks; c = next++) {
+                int i = visited.forward(boundary + chunkBegin(c) * 64);
+                int first = c;
+                while (first > 0 && chunkBegin(first) * 64 > i - boundary) {
+                    first--;
+                }
+                for (int d = first; d < c; d++) {
+                    while (!done[d]) {
+                        std::this_thread::yield();
+                    }
+                }
+                forEachCell(chunkBegin(c), chunkBegin(c + 1), [&](int j, bool live) {
+                    if (!live) {
+                        heap[j] = Value();
+                    } else if (i++ < j) {
+                        heap[i - 1] = std::move(heap[j]);
+                    }
+                });
+                done[c] = true;
+            }
+        });
+        heap.resize(boundary + ranks.back());
+        nurseryStart = heap.size();
+        remembered.clear();
+        return n - heap.size();
+    }
+    int _minorGc() {
+        stats.minorCollections++;
+        return _collect(nurseryStart);
     }
     int _gc() {
-        auto visited = _mark();
-        const auto &[removed, relocation] = _sweepAndCompact(visited);
-        _relocate(relocation);
-        return removed;
+        stats.collections++;
+        // the free cells are compacted away with the other dead cells
+        freeCells.clear();
+        return _collect(numLiterals);
+    }
+    void _updateThreshold(int total, int removed) {
+        int live = total - removed;
+        // see also "Optimal heap limits for reducing browser memory use" (OOPSLA 2022)
+        // for the square root solution
+        // (the floor keeps tiny heaps, e.g. of integer-only programs, from collecting constantly)
+        gcThreshold = std::max(live * 2, numLiterals + 64);
+    }
+    // the collection work after each step (timed as one pause)
+    void _collectGarbage() {
+        bool minor = static_cast<int>(heap.size()) - nurseryStart > NURSERY_SIZE;
+        bool cycle = gcPhase != GcPhase::idle;
+        if (!cycle && !minor) {
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (cycle) {
+            _cycleStep();
+        }
+        if (minor) {
+            _minorGc();
+            // the old generation is only collected when its live cells outgrow the threshold
+            int total = heap.size();
+            if (gcPhase == GcPhase::idle && total - static_cast<int>(freeCells.size()) > gcThreshold) {
+                if (gcBudget > 0) {
+                    _startCycle();
+                } else {
+                    _updateThreshold(total, _gc());
+                }
+            }
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        stats.maxPause = std::max(stats.maxPause, elapsed.count());
+        if (minor) {
+            _recordPause(elapsed.count());
+        }
+        // an incremental cycle is recorded once, with its longest step
+        if (cycle) {
+            cyclePause = std::max(cyclePause, elapsed.count());
+            if (gcPhase == GcPhase::idle) {
+                _recordPause(cyclePause);
+                cyclePause = 0;
+            }
+        }
+    }
+    void _recordPause(double microseconds) {
+        auto bucket = std::min<std::size_t>(
+            std::bit_width(static_cast<std::uint64_t>(microseconds)), stats.pauses.size() - 1
+        );
+        stats.pauses[bucket]++;
+    }
+    // incremental collection of the whole heap by snapshot-at-the-beginning tri-colour marking
+    // (white: not in marked; grey: in marked and on the grey stack; black: in marked and scanned):
+    // a cycle starts right after a minor collection (so the nursery is empty) by greying the roots,
+    // and the cells allocated during the cycle (at or above markLimit) are black;
+    // this needs no write barrier because old cells only change when letrec placeholders lose their Void,
+    // except that the intern table can revive a white string, so it shades the strings it returns;
+    // the cycle doesn't compact (which would be one pause over the whole heap): the swept cells become free cells,
+    // which minor collections fill with promoted survivors
+    void _startCycle() {
+        gcPhase = GcPhase::marking;
+        markLimit = heap.size();
+        markStamp = ++gcStamp;
+        marked.reset(numLiterals, markLimit);
+        grey.clear();
+        // the free cells are white, so the sweep finds them again
+        // (until then, promoted survivors are not moved below markLimit, so they stay black)
+        freeCells.clear();
+        _forEachRoot([this](Location &loc) { _shade(loc); });
+    }
+    void _shade(Location loc) {
+        if (!loc.isImmediate() && numLiterals <= loc.index() && loc.index() < markLimit &&
+            marked.insert(loc.index())) {
+            __builtin_prefetch(&heap[loc.index()]);
+            grey.push_back(loc.index());
+        }
+    }
+    // scans or sweeps up to gcBudget cells
+    void _cycleStep() {
+        int work = 0;
+        if (gcPhase == GcPhase::marking) {
+            auto shade = [this](Location &loc) { _shade(loc); };
+            while (!grey.empty() && work < gcBudget) {
+                int index = grey.back();
+                grey.pop_back();
+                _forEachChild(heap[index], markStamp, shade);
+                work++;
+            }
+            if (grey.empty()) {
+                gcPhase = GcPhase::sweeping;
+                sweepCursor = numLiterals;
+            }
+        } else {
+            // releases the payloads of white cells, and frees the cells
+            // (a free cell filled before the sweep ends is below sweepCursor, so it isn't swept again)
+            for (; sweepCursor < markLimit && work < gcBudget; sweepCursor++, work++) {
+                auto &v = heap[sweepCursor];
+                if (marked.contains(sweepCursor)) {
+                    continue;
+                }
+                if (v.is<String>() && v.getString().interned) {
+                    interned.erase(interned.find(v.getString().view()));
+                }
+                v = Void();
+                freeCells.push_back(sweepCursor);
+            }
+            if (sweepCursor == markLimit) {
+                stats.collections++;
+                _updateThreshold(heap.size(), freeCells.size());
+                gcPhase = GcPhase::idle;
+                marked = {};
+                grey.clear();
+            }
+        }
     }
     std::vector<SourceLocation> _getFrameSLs() {
         std::vector<SourceLocation> frameSLs;
         for (const auto &l : stack) {
             if (l.frame) {
-                if (l.expr == nullptr) {  // main frame
+                if (l.expr < 0) {  // main frame
                     frameSLs.emplace_back(1, 1);
                 } else {
-                    frameSLs.push_back(l.expr->sl);
+                    frameSLs.push_back(program->ast.nodes[l.expr].sl);
                 }
             }
         }
@@ -1849,12 +4093,120 @@ private:
         }
     }
 
+    // the first cell of the literal region
+    static constexpr Location VOID_LOCATION = Location::cell(0);
+    // followed by the 256 one-character strings
+    static constexpr int CHARS_BASE = 1;
+    // a minor collection runs when the nursery holds more cells than this
+    static constexpr int NURSERY_SIZE = 1 << 12;
+    // the parallel collector only collects regions of at least this many cells
+    // (waking the worker pool costs a few microseconds per phase, a few percent of a serial collection of this size)
+    static constexpr int PARALLEL_MIN_CELLS = 1 << 16;
+    // the parallel compaction moves cells in this many chunks per thread (so that threads rarely wait for each other)
+    static constexpr int MOVE_CHUNKS_PER_THREAD = 8;
+    // a marking thread shares work once its private stack has this many cells
+    static constexpr std::size_t MARK_SHARE_SIZE = 64;
+    // runtime strings up to this length are interned (string literals always are)
+    static constexpr std::size_t INTERN_LIMIT = 32;
+    // heterogeneous lookup: probing the table doesn't construct a string
+    struct InternHash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const {
+            return std::hash<std::string_view>()(s);
+        }
+    };
+
     // states
-    ExprNode *expr;
+    std::shared_ptr<Program> program;
+    Engine engine;
     std::vector<Layer> stack;
-    std::vector<Value> heap;
+    Heap heap;
     int numLiterals = 0;
+    int nurseryStart = 0;
+    // old cells patched since the last collection
+    std::vector<int> remembered;
+    int gcThreshold = 0;
+    int gcBudget = 0;
+    int gcThreads = 1;
+    // the incremental collection cycle
+    enum class GcPhase {
+        idle,
+        marking,
+        sweeping
+    };
+    GcPhase gcPhase = GcPhase::idle;
+    int markLimit = 0;
+    std::uint64_t markStamp = 0;
+    MarkBitmap marked;
+    std::vector<int> grey;
+    // the longest step of the current cycle
+    double cyclePause = 0;
+    // dead cells in the old generation (as Void), in the order of sweeping
+    std::vector<int> freeCells;
+    // the mark stack of stop-the-world collections (kept to reuse its capacity)
+    std::vector<int> markStack;
+    WorkerPool gcWorkers;
+    int sweepCursor = 0;
+    std::unordered_map<std::string, Location, InternHash, std::equal_to<>> interned;
+    // distinguishes the traversals of shared map nodes
+    std::uint64_t gcStamp = 0;
     Location resultLoc;
+    Stats stats;
+};
+
+const std::vector<State::IntrinsicInfo> State::intrinsics = {
+    _intrinsic<&State::_void>(".void"),
+    _intrinsic<&State::_integerOp<std::plus<>>, Integer, Integer>(".+"),
+    _intrinsic<&State::_integerOp<std::minus<>>, Integer, Integer>(".-"),
+    _intrinsic<&State::_integerOp<std::multiplies<>>, Integer, Integer>(".*"),
+    _intrinsic<&State::_integerDivOp<std::divides<>>, Integer, Integer>("./"),
+    _intrinsic<&State::_integerDivOp<std::modulus<>>, Integer, Integer>(".%"),
+    _intrinsic<&State::_integerCompare<std::less<>>, Integer, Integer>(".<"),
+    _intrinsic<&State::_integerCompare<std::less_equal<>>, Integer, Integer>(".<="),
+    _intrinsic<&State::_integerCompare<std::greater<>>, Integer, Integer>(".>"),
+    _intrinsic<&State::_integerCompare<std::greater_equal<>>, Integer, Integer>(".>="),
+    _intrinsic<&State::_integerCompare<std::equal_to<>>, Integer, Integer>(".="),
+    _intrinsic<&State::_integerCompare<std::not_equal_to<>>, Integer, Integer>("./="),
+    _intrinsic<&State::_integerLogic<std::logical_and<>>, Integer, Integer>(".and"),
+    _intrinsic<&State::_integerLogic<std::logical_or<>>, Integer, Integer>(".or"),
+    _intrinsic<&State::_not, Integer>(".not"),
+    _intrinsic<&State::_concat, String, String>(".s+"),
+    _intrinsic<&State::_stringCompare<std::less<std::string_view>>, String, String>(".s<"),
+    _intrinsic<&State::_stringCompare<std::less_equal<std::string_view>>, String, String>(".s<="),
+    _intrinsic<&State::_stringCompare<std::greater<std::string_view>>, String, String>(".s>"),
+    _intrinsic<&State::_stringCompare<std::greater_equal<std::string_view>>, String, String>(".s>="),
+    _intrinsic<&State::_stringEqual<true>, String, String>(".s="),
+    _intrinsic<&State::_stringEqual<false>, String, String>(".s/="),
+    _intrinsic<&State::_length, String>(".s||"),
+    _intrinsic<&State::_substring, String, Integer, Integer>(".s[]"),
+    _intrinsic<&State::_byteAt, String, Integer>(".s@"),
+    _intrinsic<&State::_byteToString, Integer>(".b->s"),
+    _intrinsic<&State::_find, String, String, Integer>(".sfind"),
+    _intrinsic<&State::_quote, String>(".quote"),
+    _intrinsic<&State::_unquote, String>(".unquote"),
+    _intrinsic<&State::_stringToInteger, String>(".s->i"),
+    _intrinsic<&State::_integerToString, Integer>(".i->s"),
+    _intrinsic<&State::_newStringBuilder>(".sb"),
+    _intrinsic<&State::_appendStringBuilder, StringBuilder, String>(".sb+"),
+    _intrinsic<&State::_finishStringBuilder, StringBuilder>(".sb->s"),
+    _intrinsic<&State::_newArray, Integer, Value>(".a*"),
+    _intrinsic<&State::_arrayLength, Array>(".a||"),
+    _intrinsic<&State::_arrayGet, Array, Integer>(".a@"),
+    _intrinsic<&State::_arraySlice, Array, Integer, Integer>(".a[]"),
+    _intrinsic<&State::_arraySet, Array, Integer, Value>(".a<-"),
+    _intrinsic<&State::_newMap>(".m"),
+    _intrinsic<&State::_mapSize, Map>(".m||"),
+    _intrinsic<&State::_mapInsert, Map, Value, Value>(".m+"),
+    _intrinsic<&State::_mapRemove, Map, Value>(".m-"),
+    _intrinsic<&State::_mapLookup, Map, Value>(".m@"),
+    _intrinsic<&State::_mapContains, Map, Value>(".m?"),
+    _intrinsic<&State::_mapKeys, Map>(".m->a"),
+    _intrinsic<&State::_type, Value>(".type"),
+    _intrinsic<&State::_eval, String>(".eval"),
+    _intrinsic<&State::_getchar>(".getchar"),
+    _intrinsic<&State::_getint>(".getint"),
+    _intrinsic<&State::_putstr, String>(".putstr"),
+    _intrinsic<&State::_flush>(".flush")
 };
 
 // ------------------------------
@@ -1878,15 +4230,89 @@ std::string readSource(const std::string &spath) {
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <source-path>\n";
+    Engine engine = Engine::ast;
+    bool printStats = false;
+    int gcBudget = 0;
+    int gcThreads = 1;
+    int copyEvery = 0;
+    std::optional<std::string> spath;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--engine=ast") {
+            engine = Engine::ast;
+        } else if (arg == "--engine=bytecode") {
+            engine = Engine::bytecode;
+        } else if (arg == "--stats") {
+            printStats = true;
+        } else if (arg.starts_with("--gc-budget=")) {
+            auto budget = arg.substr(std::string_view("--gc-budget=").size());
+            if (!budget.empty() && budget.size() <= 9 && std::all_of(budget.begin(), budget.end(), isDigitChar)) {
+                gcBudget = std::stoi(budget);
+            } else {
+                usage = true;
+            }
+        } else if (arg.starts_with("--gc-threads=")) {
+            auto threads = arg.substr(std::string_view("--gc-threads=").size());
+            if (!threads.empty() && threads.size() <= 3 && std::all_of(threads.begin(), threads.end(), isDigitChar) &&
+                std::stoi(threads) > 0) {
+                gcThreads = std::stoi(threads);
+            } else {
+                usage = true;
+            }
+        } else if (arg.starts_with("--copy-every=")) {
+            auto steps = arg.substr(std::string_view("--copy-every=").size());
+            if (!steps.empty() && steps.size() <= 9 && std::all_of(steps.begin(), steps.end(), isDigitChar) &&
+                std::stoi(steps) > 0) {
+                copyEvery = std::stoi(steps);
+            } else {
+                usage = true;
+            }
+        } else if (!spath.has_value() && !arg.starts_with("--")) {
+            spath = arg;
+        } else {
+            usage = true;
+        }
+    }
+    if (usage || !spath.has_value()) {
+        std::cerr << "Usage: " << argv[0] << " [--engine=ast|bytecode] [--stats] [--gc-budget=N] [--gc-threads=N] [--copy-every=N] <source-path>\n";
         std::exit(EXIT_FAILURE);
     }
     try {
-        std::string source = readSource(argv[1]);
-        State state(std::move(source));
-        state.execute();
+        std::string source = readSource(spath.value());
+        State state(std::move(source), engine);
+        state.setGcBudget(gcBudget);
+        state.setGcThreads(gcThreads);
+        auto start = std::chrono::steady_clock::now();
+        if (copyEvery > 0) {
+            // suspends and resumes the execution on a copy of the state every copyEvery steps (for testing)
+            bool running = true;
+            while (running) {
+                State copy(state);
+                for (int i = 0; i < copyEvery && running; i++) {
+                    running = copy.step();
+                }
+                state = std::move(copy);
+            }
+        } else {
+            state.execute();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
         std::cout << "<end-of-stdout>\n" << valueToString(state.getResult()) << std::endl;
+        if (printStats) {
+            const auto &stats = state.getStats();
+            std::cerr << "[stats] " << stats.steps << " steps in " << elapsed.count() << " seconds ("
+                      << stats.steps / elapsed.count() << " steps per second), "
+                      << stats.allocations << " allocations, " << stats.collections << " collections, "
+                      << stats.minorCollections << " minor collections\n";
+            std::cerr << "[pauses]";
+            for (std::size_t i = 0; i < stats.pauses.size(); i++) {
+                if (stats.pauses[i] > 0) {
+                    std::cerr << " <" << (std::uint64_t(1) << i) << "us: " << stats.pauses[i] << ",";
+                }
+            }
+            std::cerr << " max " << stats.maxPause << "us\n";
+        }
     } catch (const std::runtime_error &e) {
         std::cerr << e.what() << std::endl;
         std::exit(EXIT_FAILURE);